@@ -0,0 +1,417 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <gtk/gtk.h>
+#include <pthread.h>
+
+#include <alsa/asoundlib.h>
+
+#include "libslowrx.h"
+#include "gui.h"
+
+/*
+ * Stuff related to sound card capture
+ *
+ * A card is opened once however many panels listen to it: each panel gets
+ * a PcmSource for one channel, and whichever capture thread runs out of
+ * samples first reads the next frames for both.
+ *
+ */
+
+// Device list suffix for the second channel of a card
+#define RIGHT " (right)"
+
+// Frames kept for the channel that's behind
+#define ALSA_FRAMES (PCM_CHUNK * 8)
+
+// One open capture device
+typedef struct _AlsaDevice AlsaDevice;
+struct _AlsaDevice {
+  char            *Name;                      // as in the device list, without RIGHT
+  snd_pcm_t       *handle;
+  unsigned         channels;
+  unsigned         rate;
+  int              Users;                     // channels open on it
+  int              Running;                   // of them capturing
+  pthread_mutex_t  Lock;
+  gint16           Frames[ALSA_FRAMES * 2];   // last frames read, interleaved
+  guint64          Got;                       // frames read so far
+};
+
+// One channel of a device, the Data of its PcmSource
+typedef struct _AlsaChannel AlsaChannel;
+struct _AlsaChannel {
+  AlsaDevice *dev;
+  int         Channel;
+  guint64     Taken;                          // frames handed to the decoder
+  gboolean    Dropping;
+  Panel      *panel;
+};
+
+// Devices open at the moment; only touched from the GUI thread
+static GSList *Devices = NULL;
+
+// Show a device problem on the panel's status icon
+static void devStatus(Panel *p, const gchar *stock, char *text) {
+  gdk_threads_enter();
+  if (stock != NULL)
+    gtk_image_set_from_stock(GTK_IMAGE(p->image_devstatus),stock,GTK_ICON_SIZE_SMALL_TOOLBAR);
+  gtk_widget_set_tooltip_text(p->image_devstatus, text);
+  gdk_threads_leave();
+}
+
+// Read the next numframes frames from the card into the shared frame ring
+// (called with the device locked)
+static int readFrames(AlsaChannel *ch, int numframes) {
+
+  AlsaDevice *dev = ch->dev;
+  gint16     *dest = dev->Frames + (dev->Got % ALSA_FRAMES) * dev->channels;
+  int         samplesread;
+
+  samplesread = snd_pcm_readi(dev->handle, dest, numframes);
+
+  if (samplesread < numframes) {
+
+    if      (samplesread == -EPIPE) {
+      printf("ALSA: buffer overrun\n");
+      // Capture runs continuously, so get the device going again
+      snd_pcm_prepare(dev->handle);
+    }
+    else if (samplesread < 0) {
+      printf("ALSA error %d (%s)\n", samplesread, snd_strerror(samplesread));
+      devStatus(ch->panel, NULL, "ALSA error");
+      return -1;
+    }
+    else
+      printf("Can't read %d samples\n", numframes);
+
+    // On first appearance of error, update the status icon
+    if (!ch->Dropping) {
+      devStatus(ch->panel, GTK_STOCK_DIALOG_WARNING, "Device is dropping samples");
+      ch->Dropping = TRUE;
+    }
+
+    if (samplesread < 0) samplesread = 0;
+    memset(dest + samplesread * dev->channels, 0, (numframes - samplesread) * dev->channels * sizeof(gint16));
+  }
+
+  // A live device never ends; dropped samples are not end of stream
+  dev->Got += numframes;
+  return numframes;
+}
+
+// Hand fresh samples of one channel to its decoder (runs in the capture thread)
+static int readAlsa(PcmSource *s, gint16 *dest, int numsamples) {
+
+  AlsaChannel *ch  = s->Data;
+  AlsaDevice  *dev = ch->dev;
+  int          i, n;
+
+  pthread_mutex_lock(&dev->Lock);
+
+  // Fetch frames until this channel has enough
+  while (ch->Taken + numsamples > dev->Got) {
+    n = MIN(PCM_CHUNK, ALSA_FRAMES - dev->Got % ALSA_FRAMES);
+    if (readFrames(ch, n) < 0) {
+      pthread_mutex_unlock(&dev->Lock);
+      return -1;
+    }
+  }
+
+  // The other channel read so much that ours got overwritten
+  if (dev->Got - ch->Taken > ALSA_FRAMES) {
+    if (!ch->Dropping) {
+      printf("ALSA: %s channel %d fell behind\n", dev->Name, ch->Channel);
+      ch->Dropping = TRUE;
+    }
+    ch->Taken = dev->Got - numsamples;
+  }
+
+  for (i=0; i<numsamples; i++)
+    dest[i] = dev->Frames[((ch->Taken + i) % ALSA_FRAMES) * dev->channels + ch->Channel];
+  ch->Taken += numsamples;
+
+  pthread_mutex_unlock(&dev->Lock);
+
+  return numsamples;
+
+}
+
+// Called by the capture thread when it starts and exits; the card runs
+// while any of its channels does
+static void startAlsa(PcmSource *s) {
+  AlsaChannel *ch  = s->Data;
+  AlsaDevice  *dev = ch->dev;
+
+  pthread_mutex_lock(&dev->Lock);
+  if (dev->Running++ == 0) {
+    snd_pcm_prepare(dev->handle);
+    snd_pcm_start  (dev->handle);
+  }
+  ch->Taken = dev->Got;
+  pthread_mutex_unlock(&dev->Lock);
+}
+
+static void stopAlsa(PcmSource *s) {
+  AlsaChannel *ch  = s->Data;
+  AlsaDevice  *dev = ch->dev;
+
+  pthread_mutex_lock(&dev->Lock);
+  if (--dev->Running == 0) snd_pcm_drop(dev->handle);
+  pthread_mutex_unlock(&dev->Lock);
+}
+
+// Free the source, which was made by initPcmDevice(), and the card with the last of its channels
+static void closeAlsa(PcmSource *s) {
+  AlsaChannel *ch  = s->Data;
+  AlsaDevice  *dev = ch->dev;
+
+  if (--dev->Users == 0) {
+    Devices = g_slist_remove(Devices, dev);
+    snd_pcm_close(dev->handle);
+    pthread_mutex_destroy(&dev->Lock);
+    g_free(dev->Name);
+    free(dev);
+  }
+
+  free(ch);
+  free(s);
+}
+
+// Add an entry to the device list, selected if it's the one configured
+static void addDevice(Panel *p, char *name, char *wanted) {
+  GtkTreeModel *model = gtk_combo_box_get_model(GTK_COMBO_BOX(p->combo_card));
+
+  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(p->combo_card), name);
+  if (wanted != NULL && strcmp(name, wanted) == 0)
+    gtk_combo_box_set_active(GTK_COMBO_BOX(p->combo_card), gtk_tree_model_iter_n_children(model, NULL) - 1);
+}
+
+void populateDeviceList(Panel *p) {
+  int                  card;
+  char                *cardname, *dev, *right;
+  int                  numcards;
+  char                 key[20];
+
+  configKey(p, "device", key, sizeof(key));
+  dev = g_key_file_get_string(config,"slowrx",key,NULL);
+
+  gdk_threads_enter();
+  addDevice(p, "default", dev);
+  addDevice(p, "default" RIGHT, dev);
+  gdk_threads_leave();
+
+  numcards = 0;
+  card     = -1;
+  do {
+    snd_card_next(&card);
+    if (card != -1) {
+      snd_card_get_name(card,&cardname);
+      right = g_strconcat(cardname, RIGHT, NULL);
+      gdk_threads_enter();
+
+      // Without a device configured, the first panel takes the cards in turn as before
+      addDevice(p, cardname, (dev == NULL && p->Index == 0) ? cardname : dev);
+      addDevice(p, right,    dev);
+
+      gdk_threads_leave();
+      g_free(right);
+      numcards++;
+    }
+  } while (card != -1);
+
+  // Raw S16 or WAV piped in from rtl_fm, sox etc.
+  gdk_threads_enter();
+  addDevice(p, "stdin", dev);
+  gdk_threads_leave();
+
+  if (numcards == 0)
+    fprintf(stderr, "No sound devices found!\n");
+
+  g_free(dev);
+}
+
+// Open a sound card, or find it open already
+static AlsaDevice *openDevice(char *devname, int *status) {
+
+  snd_pcm_hw_params_t *hwparams;
+  char                 pcm_name[30];
+  unsigned int         exact_rate = 44100;
+  int                  card;
+  gboolean             found;
+  char                *cardname;
+  snd_pcm_t           *handle;
+  unsigned             channels;
+  AlsaDevice          *dev;
+  GSList              *l;
+
+  for (l = Devices; l != NULL; l = l->next) {
+    dev = l->data;
+    if (strcmp(dev->Name, devname) == 0) {
+      *status = (dev->rate >= MINRATE ? 0 : -1);
+      return dev;
+    }
+  }
+
+  *status = -2;
+
+  snd_pcm_hw_params_alloca(&hwparams);
+
+  card  = -1;
+  found = FALSE;
+  if (strcmp(devname,"default") == 0) {
+    found=TRUE;
+  } else {
+    do {
+      snd_card_next(&card);
+      if (card != -1) {
+        snd_card_get_name(card,&cardname);
+        if (strcmp(cardname, devname) == 0) {
+          found=TRUE;
+          break;
+        }
+      }
+    } while (card != -1);
+  }
+
+  if (!found) {
+    perror("Device disconnected?\n");
+    return NULL;
+  }
+
+  if (strcmp(devname,"default") == 0) {
+    sprintf(pcm_name,"default");
+  } else {
+    sprintf(pcm_name,"hw:%d",card);
+  }
+
+  if (snd_pcm_open(&handle, pcm_name, SND_PCM_STREAM_CAPTURE, 0) < 0) {
+    perror("ALSA: Error opening PCM device");
+    return NULL;
+  }
+
+  /* Init hwparams with full configuration space */
+  if (snd_pcm_hw_params_any(handle, hwparams) < 0) {
+    perror("ALSA: Can not configure this PCM device.");
+    snd_pcm_close(handle);
+    return NULL;
+  }
+
+  if (snd_pcm_hw_params_set_access(handle, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
+    perror("ALSA: Error setting interleaved access.");
+    snd_pcm_close(handle);
+    return NULL;
+  }
+  if (snd_pcm_hw_params_set_format(handle, hwparams, SND_PCM_FORMAT_S16_LE) < 0) {
+    perror("ALSA: Error setting format S16_LE.");
+    snd_pcm_close(handle);
+    return NULL;
+  }
+  if (snd_pcm_hw_params_set_rate_near(handle, hwparams, &exact_rate, 0) < 0) {
+    perror("ALSA: Error setting sample rate.");
+    snd_pcm_close(handle);
+    return NULL;
+  }
+
+  // Try stereo first
+  channels = 2;
+  if (snd_pcm_hw_params_set_channels(handle, hwparams, 2) < 0) {
+    // Fall back to mono
+    channels = 1;
+    if (snd_pcm_hw_params_set_channels(handle, hwparams, 1) < 0) {
+      perror("ALSA: Error setting channels.");
+      snd_pcm_close(handle);
+      return NULL;
+    }
+  }
+  if (snd_pcm_hw_params(handle, hwparams) < 0) {
+    perror("ALSA: Error setting HW params.");
+    snd_pcm_close(handle);
+    return NULL;
+  }
+
+  dev = calloc(1, sizeof(AlsaDevice));
+  if (dev == NULL) {
+    perror("openDevice: Unable to allocate memory for device");
+    exit(EXIT_FAILURE);
+  }
+  dev->Name     = g_strdup(devname);
+  dev->handle   = handle;
+  dev->channels = channels;
+  dev->rate     = exact_rate;
+  pthread_mutex_init(&dev->Lock, NULL);
+  Devices = g_slist_prepend(Devices, dev);
+
+  if (exact_rate < MINRATE) {
+    fprintf(stderr, "ALSA: Got only %d Hz. Expect artifacts.\n", exact_rate);
+    *status = -1;
+  } else {
+    *status = 0;
+  }
+
+  return dev;
+}
+
+// Initialize sound card for the panel's decoder; names ending in RIGHT
+// take the second channel
+// Return value:
+//   0 = opened ok
+//  -1 = opened, but suboptimal
+//  -2 = couldn't be opened
+int initPcmDevice(Panel *p, char *wanteddevname) {
+
+  AlsaDevice  *dev;
+  AlsaChannel *ch;
+  PcmSource   *s;
+  char        *devname;
+  int          Channel = 0, status;
+
+  if (g_str_has_suffix(wanteddevname, RIGHT)) {
+    devname = g_strndup(wanteddevname, strlen(wanteddevname) - strlen(RIGHT));
+    Channel = 1;
+  } else {
+    devname = g_strdup(wanteddevname);
+  }
+
+  dev = openDevice(devname, &status);
+  g_free(devname);
+  if (dev == NULL) return(-2);
+
+  if (Channel >= (int)dev->channels) {
+    fprintf(stderr, "ALSA: %s is mono\n", dev->Name);
+    if (dev->Users == 0) {
+      Devices = g_slist_remove(Devices, dev);
+      snd_pcm_close(dev->handle);
+      pthread_mutex_destroy(&dev->Lock);
+      g_free(dev->Name);
+      free(dev);
+    }
+    return(-2);
+  }
+
+  s  = calloc(1, sizeof(PcmSource));
+  ch = calloc(1, sizeof(AlsaChannel));
+  if (s == NULL || ch == NULL) {
+    perror("initPcmDevice: Unable to allocate memory for device");
+    exit(EXIT_FAILURE);
+  }
+  ch->dev     = dev;
+  ch->Channel = Channel;
+  ch->panel   = p;
+  dev->Users++;
+
+  s->Name  = "alsa";
+  s->Live  = TRUE;
+  s->Rate  = dev->rate;
+  s->Read  = readAlsa;
+  s->Start = startAlsa;
+  s->Stop  = stopAlsa;
+  s->Close = closeAlsa;
+  s->Data  = ch;
+
+  openPcm(p->dec, s);
+
+  return(status);
+
+}
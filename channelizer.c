@@ -0,0 +1,287 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Polyphase channelizer
+ *
+ * Splits a wideband recording (audio, or IQ from an SDR) into channels
+ * Spacing Hz apart, each read by a decoder of its own, so stations sending
+ * at once don't get in each other's way. The prototype low-pass h is cut
+ * into M = Rate/Spacing branches; every D = M/BANK_OVER input samples one
+ * M-point inverse FFT of the branch outputs gives the next sample of all
+ * channels at once:
+ *
+ *   y_k[m] = e^(-j 2pi k m/M) sum_r e^(j 2pi k r/M) sum_p h[pM+r] x[m-pM-r]
+ *
+ * The channels are oversampled, so a station halfway between two centers
+ * comes through both of them whole. Each one is moved up to CHANNEL_AUDIO
+ * and handed to its decoder at the channel rate, which is kept at or above
+ * BANK_MINRATE by taking D smaller where the spacing alone wouldn't.
+ *
+ */
+
+#define BANK_ATTEN   70.0           // stop band attenuation in dB
+#define BANK_TRANS   500.0          // transition band in Hz
+#define BANK_EDGE    1000.0         // pass band beyond Spacing/2, for the video band around the leader
+#define BANK_MINRATE 11025.0        // decoders' default rate
+
+// Room for another block in every channel someone reads
+static gboolean bankRoom(ChannelBank *b) {
+  int i;
+  for (i = 0; i < b->NumChannels; i++)
+    if (b->Channels[i].Open && b->Channels[i].Head - b->Channels[i].Taken >= BANK_RING)
+      return FALSE;
+  return TRUE;
+}
+
+// Move the channel up to CHANNEL_AUDIO and keep the real part
+static void channelFeed(ChannelBank *b, BankChannel *c, double re, double im) {
+
+  double v = b->Gain * (re * cos(2*M_PI*c->Phase) - im * sin(2*M_PI*c->Phase));
+
+  c->Ring[c->Head++ & (BANK_RING-1)] = (v >= 32767 ? 32767 : (v <= -32768 ? -32768 : v));
+
+  c->Phase += CHANNEL_AUDIO / b->ChanRate;
+  if (c->Phase >= 1) c->Phase -= 1;
+}
+
+// Read D more samples and give every open channel its next one
+static void bankBlock(ChannelBank *b) {
+
+  int      i, n, p, r, P = b->L / b->M;
+  double   re, im, ph;
+  guint64  m;
+  dsp_complex *x = b->x + b->L, *y;
+
+  n = readWide(b->File, x, b->D);
+  if (n < b->D) {
+    memset(x + n, 0, (b->D - n) * sizeof(dsp_complex));
+    b->EndOfFile = TRUE;
+  }
+
+  if (b->Base != 0) {
+    for (i = 0; i < b->D; i++) {
+      ph       = -2 * M_PI * b->MixPhase;
+      re       = x[i][0] * cos(ph) - x[i][1] * sin(ph);
+      im       = x[i][0] * sin(ph) + x[i][1] * cos(ph);
+      x[i][0]  = re;
+      x[i][1]  = im;
+      b->MixPhase += b->Base / b->Rate;
+      if (b->MixPhase >= 1) b->MixPhase -= 1;
+    }
+  }
+
+  memmove(b->x, b->x + b->D, b->L * sizeof(dsp_complex));
+  b->Fed += b->D;
+
+  // Branch outputs, newest sample last
+  x = b->x + b->L - 1;
+  for (r = 0; r < b->M; r++) {
+    re = im = 0;
+    for (p = 0; p < P; p++) {
+      re += b->h[p*b->M + r] * x[-(p*b->M + r)][0];
+      im += b->h[p*b->M + r] * x[-(p*b->M + r)][1];
+    }
+    b->buf[r][0] = re;
+    b->buf[r][1] = im;
+  }
+
+  FFTW(execute_dft)(b->Inv, b->buf, b->buf);
+
+  m = (b->Fed - 1) % b->M;
+  for (i = 0; i < b->NumChannels; i++) {
+    if (!b->Channels[i].Open) continue;
+    y  = &b->buf[b->Channels[i].Bin];
+    r  = (b->Channels[i].Bin * m) % b->M;
+    re = (*y)[0] * b->Twiddle[r][0] - (*y)[1] * b->Twiddle[r][1];
+    im = (*y)[0] * b->Twiddle[r][1] + (*y)[1] * b->Twiddle[r][0];
+    channelFeed(b, &b->Channels[i], re, im);
+  }
+
+  b->Blocks++;
+}
+
+// PcmSource.Read() of a channel: run the bank until this channel has enough
+static int readChannel(PcmSource *s, gint16 *dest, int numsamples) {
+
+  BankChannel *c = s->Data;
+  ChannelBank *b = c->Bank;
+  int          got = 0, n;
+
+  pthread_mutex_lock(&b->Lock);
+
+  while (got < numsamples) {
+
+    if (c->Head > c->Taken) {
+      n = MIN(c->Head - c->Taken, (guint64)(numsamples - got));
+      for (; n > 0; n--) dest[got++] = c->Ring[c->Taken++ & (BANK_RING-1)];
+      continue;
+    }
+
+    if (b->EndOfFile) break;
+
+    // Some other decoder is behind; wait for it to catch up
+    if (!bankRoom(b)) {
+      pthread_mutex_unlock(&b->Lock);
+      g_usleep(1000);
+      pthread_mutex_lock(&b->Lock);
+      continue;
+    }
+
+    bankBlock(b);
+  }
+
+  pthread_mutex_unlock(&b->Lock);
+
+  return got;
+}
+
+// PcmSource.Close() of a channel: don't wait for it any more
+static void closeChannel(PcmSource *s) {
+  BankChannel *c = s->Data;
+
+  pthread_mutex_lock(&c->Bank->Lock);
+  c->Open = FALSE;
+  pthread_mutex_unlock(&c->Bank->Lock);
+}
+
+/* Open a recording to be split into NumChannels channels
+ *   format:   "wav", "s16", "f32", "cu8" (rtl_sdr IQ) or NULL, as for initPcmFile()
+ *   rate:     of headerless files
+ *   Spacing:  between channel centers in Hz, at least 1000; rounded so
+ *             that it divides the sample rate
+ *   returns   NULL if the file can't be read
+ *
+ * Audio channels go up from 1900 Hz, IQ channels are centered on 0 Hz;
+ * see channelFreq(). Every channel is read at the same rate, Rate / D.
+ */
+ChannelBank *openChannelBank(char *filename, char *format, int rate, double Spacing, int NumChannels) {
+
+  ChannelBank *b;
+  BankChannel *c;
+  int          i, k, P;
+
+  b = calloc(1, sizeof(ChannelBank));
+  if (b == NULL) {
+    perror("openChannelBank: Unable to allocate memory for channel bank");
+    exit(EXIT_FAILURE);
+  }
+
+  b->File = openWideFile(filename, format, &rate, &b->Complex);
+  if (b->File == NULL) {
+    free(b);
+    return NULL;
+  }
+
+  if (Spacing < 1000) Spacing = 1000;
+
+  b->Rate     = rate;
+  b->M        = BANK_OVER * MAX(1, (int)round(b->Rate / (BANK_OVER * Spacing)));
+  b->Spacing  = b->Rate / b->M;
+
+  // Room for the whole pass band above 0 Hz and below half the channel rate
+  b->D        = b->Rate / MAX(BANK_MINRATE, 2 * (CHANNEL_AUDIO + b->Spacing/2 + BANK_EDGE + BANK_TRANS));
+  b->D        = CLAMP(b->D, 1, b->M / BANK_OVER);
+  b->ChanRate = b->Rate / b->D;
+  b->Base     = (b->Complex ? 0 : 1900);
+  b->Gain     = (b->Complex ? 1 : 2);   // half of real audio is in the negative frequencies
+
+  // Long enough for the transition band
+  P           = ceil(4.32 * b->Rate / BANK_TRANS / b->M);
+  b->L        = P * b->M;
+
+  b->h        = malloc(b->L * sizeof(dsp_t));
+  b->x        = FFTW(alloc_complex)(b->L + b->D);
+  b->Twiddle  = FFTW(alloc_complex)(b->M);
+  b->buf      = FFTW(alloc_complex)(b->M);
+  b->Channels = calloc(NumChannels, sizeof(BankChannel));
+  if (b->h == NULL || b->x == NULL || b->Twiddle == NULL || b->buf == NULL || b->Channels == NULL) {
+    perror("openChannelBank: Unable to allocate memory for channel bank");
+    exit(EXIT_FAILURE);
+  }
+  memset(b->x, 0, (b->L + b->D) * sizeof(dsp_complex));
+
+  kaiserLowpass(b->h, b->L, (b->Spacing/2 + BANK_EDGE + BANK_TRANS/2) / b->Rate, BANK_ATTEN);
+
+  for (i = 0; i < b->M; i++) {
+    b->Twiddle[i][0] = cos(-2 * M_PI * i / b->M);
+    b->Twiddle[i][1] = sin(-2 * M_PI * i / b->M);
+  }
+  b->Inv = getComplexPlan(b->M, FFTW_BACKWARD);
+
+  b->NumChannels = NumChannels;
+  for (i = 0; i < NumChannels; i++) {
+    c         = &b->Channels[i];
+    k         = (b->Complex ? i - NumChannels/2 : i);
+    c->Bank   = b;
+    c->Bin    = ((k % b->M) + b->M) % b->M;
+    c->Center = b->Base + k * b->Spacing;
+    c->Ring   = malloc(BANK_RING * sizeof(gint16));
+    if (c->Ring == NULL) {
+      perror("openChannelBank: Unable to allocate memory for channel");
+      exit(EXIT_FAILURE);
+    }
+
+    c->Source.Name  = "channel";
+    c->Source.Live  = FALSE;
+    c->Source.Rate  = b->ChanRate;
+    c->Source.Read  = readChannel;
+    c->Source.Close = closeChannel;
+    c->Source.Data  = c;
+  }
+
+  if (NumChannels > b->M || (!b->Complex && b->Channels[NumChannels-1].Center + b->Spacing/2 + BANK_EDGE > b->Rate/2))
+    fprintf(stderr, "%d channels %.0f Hz apart don't fit in %d Hz; the highest will be garbage\n",
+        NumChannels, b->Spacing, rate);
+
+  printf("channelizer: %d channels %.1f Hz apart at %.1f Hz, %d taps\n",
+      NumChannels, b->Spacing, b->ChanRate, b->L);
+
+  pthread_mutex_init(&b->Lock, NULL);
+
+  return b;
+}
+
+// Have decoder d read channel Channel of b
+void openChannel(Decoder *d, ChannelBank *b, int Channel) {
+  BankChannel *c = &b->Channels[Channel];
+
+  pthread_mutex_lock(&b->Lock);
+  c->Open   = TRUE;
+  c->Head   = c->Taken = 0;
+  c->Phase  = 0;
+  pthread_mutex_unlock(&b->Lock);
+
+  openPcm(d, &c->Source);
+}
+
+// Center of a channel in the recording; it's at CHANNEL_AUDIO in the channel
+double channelFreq(ChannelBank *b, int Channel) {
+  return b->Channels[Channel].Center;
+}
+
+double channelSpacing(ChannelBank *b) {
+  return b->Spacing;
+}
+
+// Close the recording; every decoder reading from b must have closed it first
+void closeChannelBank(ChannelBank *b) {
+  int i;
+
+  closeWideFile(b->File);
+  for (i = 0; i < b->NumChannels; i++) free(b->Channels[i].Ring);
+  free(b->Channels);
+  free(b->h);
+  FFTW(free)(b->x);
+  FFTW(free)(b->Twiddle);
+  FFTW(free)(b->buf);
+  pthread_mutex_destroy(&b->Lock);
+  free(b);
+}
@@ -0,0 +1,287 @@
+/*
+ * slowrx-cli - headless SSTV decoder for recorded audio
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ *
+ * Runs recordings through the same VIS -> video -> slant -> FSK ID chain as
+ * the GUI, as fast as the file can be read. Uses nothing but libslowrx.h.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include "libslowrx.h"
+
+static gboolean  NoSlant = FALSE, NoFSK = FALSE, NoAdapt = FALSE, Bench = FALSE, HardSync = FALSE;
+static gchar    *Format  = NULL;
+static gchar    *Demod   = NULL;
+static gchar    *Slant   = NULL;
+static gchar    *Planner = NULL;
+static gchar    *OutDir  = ".";
+static gint      RawRate = 44100;
+static gint      NumChannels = 1;
+static gdouble   Spacing = 2000;
+static gint      Rate    = 11025;
+
+// Time spent demodulating video, and the length of the video demodulated
+static double    VideoTime, VideoLength;
+static GMutex    VideoLock;
+
+// One channel of a split recording, the User of its decoder
+typedef struct {
+  ChannelBank *Bank;
+  int          Index;
+  Decoder     *dec;
+} Channel;
+
+static GOptionEntry Options[] = {
+  { "format",   'f', 0, G_OPTION_ARG_STRING, &Format,  "Sample format: wav, s16, f32 or cu8 (rtl_sdr IQ) (default: detect)", "FMT" },
+  { "rate",     'r', 0, G_OPTION_ARG_INT,    &RawRate, "Sample rate of raw input (default: 44100)", "HZ" },
+  { "channels", 'c', 0, G_OPTION_ARG_INT,    &NumChannels, "Split the input into N channels, decoded side by side (default: 1)", "N" },
+  { "spacing",  0,   0, G_OPTION_ARG_DOUBLE, &Spacing, "Channel spacing (default: 2000)", "HZ" },
+  { "dsp-rate", 0,   0, G_OPTION_ARG_INT,    &Rate,    "Decimate to about this rate before decoding, 0 = don't (default: 11025)", "HZ" },
+  { "outdir",   'o', 0, G_OPTION_ARG_STRING, &OutDir,  "Directory for received pictures (default: .)", "DIR" },
+  { "no-slant", 0,   0, G_OPTION_ARG_NONE,   &NoSlant, "Don't correct slant", NULL },
+  { "slant",    's', 0, G_OPTION_ARG_STRING, &Slant,   "Slant estimator: hough, fit or track (default: track)", "NAME" },
+  { "no-fsk",   0,   0, G_OPTION_ARG_NONE,   &NoFSK,   "Don't decode FSK ID", NULL },
+  { "no-adapt", 0,   0, G_OPTION_ARG_NONE,   &NoAdapt, "Disable adaptive noise reduction", NULL },
+  { "hard-sync", 0,  0, G_OPTION_ARG_NONE,   &HardSync, "Keep only yes/no sync decisions (saves memory on long modes)", NULL },
+  { "demod",    'd', 0, G_OPTION_ARG_STRING, &Demod,   "FM demodulator: fft, sdft or hilbert (default: fft)", "NAME" },
+  { "fftw",     0,   0, G_OPTION_ARG_STRING, &Planner, "FFTW planner: estimate, measure, patient or exhaustive (default: measure)", "LEVEL" },
+  { "bench",    'b', 0, G_OPTION_ARG_NONE,   &Bench,   "Time every demodulator on the input; no pictures are saved", NULL },
+  { NULL, 0, 0, 0, NULL, NULL, NULL }
+};
+
+
+/*** Decoder callbacks ***/
+
+// Name of the file being decoded, for picture names
+static gchar *BaseName;
+
+// How far a station is from the center of its channel
+static double channelOffset(gshort HedrShift) {
+  return HedrShift + 1900 - CHANNEL_AUDIO;
+}
+
+/* A station between two channel centers is heard in both; only the one
+ * it's nearer to takes it
+ */
+static gboolean rxVIS(Decoder *d, guchar Mode, gshort HedrShift) {
+  Channel *c = getUser(d);
+
+  (void)Mode;
+
+  if (c == NULL) return TRUE;
+  return (channelOffset(HedrShift) >= -channelSpacing(c->Bank)/2 &&
+          channelOffset(HedrShift) <   channelSpacing(c->Bank)/2);
+}
+
+// Name pictures after the file and their offset in it, and the frequency if split
+static void rxStart(Decoder *d) {
+  Channel *c   = getUser(d);
+  PicMeta *Pic = getPic(d);
+
+  if (c == NULL)
+    snprintf(Pic->timestr, sizeof(Pic->timestr), "%.24s-%06.0fs", BaseName,
+        getSamplesRead(d) / getSampleRate(d));
+  else
+    snprintf(Pic->timestr, sizeof(Pic->timestr), "%.16s-%06.0fs-%.0fHz", BaseName,
+        getSamplesRead(d) / getSampleRate(d), channelFreq(c->Bank, c->Index) + channelOffset(Pic->HedrShift));
+}
+
+static void rxImage(Decoder *d, gboolean Finished) {
+  PicMeta *Pic = getPic(d);
+
+  (void)Finished;
+
+  g_mutex_lock(&VideoLock);
+  VideoTime   += Pic->VideoTime;
+  VideoLength += ModeSpec[Pic->Mode].LineTime * ModeSpec[Pic->Mode].NumLines;
+  g_mutex_unlock(&VideoLock);
+
+  if (!Bench) savePic(d, OutDir);
+}
+
+static DecoderCallbacks Callbacks = {
+  .VIS   = rxVIS,
+  .Start = rxStart,
+  .Image = rxImage
+};
+
+
+static gpointer runChannel(gpointer data) {
+  Channel *c = data;
+
+  while (receivePic(c->dec));
+
+  return NULL;
+}
+
+/* Decode every picture in every channel of one file, a thread per channel
+ *   Template:  whose options the channels' decoders get
+ *   returns    seconds read, -1 if the file couldn't be read
+ */
+static double decodeChannels(Decoder *Template, char *filename) {
+
+  ChannelBank *b;
+  Channel     *Chan;
+  GThread    **Threads;
+  double       Duration;
+  int          i;
+
+  b = openChannelBank(filename, Format, RawRate, Spacing, NumChannels);
+  if (b == NULL) return -1;
+
+  Chan    = g_new0(Channel, NumChannels);
+  Threads = g_new0(GThread*, NumChannels);
+
+  for (i = 0; i < NumChannels; i++) {
+    Chan[i].Bank  = b;
+    Chan[i].Index = i;
+    Chan[i].dec   = newDecoder(&Callbacks, &Chan[i]);
+    *getOptions(Chan[i].dec) = *getOptions(Template);
+    openChannel(Chan[i].dec, b, i);
+  }
+
+  for (i = 0; i < NumChannels; i++)
+    Threads[i] = g_thread_new("channel", runChannel, &Chan[i]);
+
+  for (i = 0; i < NumChannels; i++)
+    g_thread_join(Threads[i]);
+
+  Duration = getSamplesRead(Chan[0].dec) / getSampleRate(Chan[0].dec);
+
+  for (i = 0; i < NumChannels; i++)
+    freeDecoder(Chan[i].dec);
+  closeChannelBank(b);
+
+  g_free(Threads);
+  g_free(Chan);
+
+  return Duration;
+}
+
+// Decode every picture in one file
+static void decodeFile(Decoder *d, char *filename) {
+
+  gint64   StartTime;
+  double   Elapsed, Duration;
+  gboolean Split = (NumChannels > 1 || (Format != NULL && strcmp(Format, "cu8") == 0));
+
+  if (!Split && initPcmFile(d, filename, Format, RawRate) == -2) return;
+
+  BaseName  = (strcmp(filename, "-") == 0 ? g_strdup("stdin") : g_path_get_basename(filename));
+  StartTime = g_get_monotonic_time();
+
+  // Pictures until the end of the file
+  if (Split) {
+    Duration = decodeChannels(d, filename);
+    if (Duration < 0) {
+      g_free(BaseName);
+      return;
+    }
+  } else {
+    while (receivePic(d));
+    Duration = getSamplesRead(d) / getSampleRate(d);
+  }
+
+  Elapsed  = (g_get_monotonic_time() - StartTime) / (double)G_USEC_PER_SEC;
+  printf("%s: %.1f s of audio in %.2f s (%.1fx realtime)\n", BaseName, Duration, Elapsed,
+      Elapsed > 0 ? Duration / Elapsed : 0);
+
+  if (!Split) closePcm(d);
+  g_free(BaseName);
+}
+
+
+/*
+ * main
+ */
+
+int main(int argc, char *argv[]) {
+
+  GOptionContext *context;
+  GError         *error = NULL;
+  Decoder        *d;
+  DecoderOptions *opt;
+  double          BenchTime[8];
+  int             i, e;
+
+  context = g_option_context_new("FILE... - decode SSTV pictures from audio recordings (- = stdin)");
+  g_option_context_add_main_entries(context, Options, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    fprintf(stderr, "%s\n", error->message);
+    exit(EXIT_FAILURE);
+  }
+  g_option_context_free(context);
+
+  if (argc < 2) {
+    fprintf(stderr, "No input files\n");
+    exit(EXIT_FAILURE);
+  }
+
+  if (NumChannels < 1) {
+    fprintf(stderr, "Need at least one channel\n");
+    exit(EXIT_FAILURE);
+  }
+
+  initFFT(Planner);
+
+  d   = newDecoder(&Callbacks, NULL);
+  opt = getOptions(d);
+
+  opt->Adaptive  = !NoAdapt;
+  opt->AutoSlant = !NoSlant;
+  opt->FSK       = !NoFSK;
+  opt->SoftSync  = !HardSync;
+  opt->Rate      = Rate;
+
+  if (Demod != NULL) {
+    if (getDemodEngine(Demod) < 0) {
+      fprintf(stderr, "Unknown demodulator '%s'\n", Demod);
+      exit(EXIT_FAILURE);
+    }
+    opt->DemodEngine = getDemodEngine(Demod);
+  }
+
+  if (Slant != NULL) {
+    if (getSlantMethod(Slant) < 0) {
+      fprintf(stderr, "Unknown slant estimator '%s'\n", Slant);
+      exit(EXIT_FAILURE);
+    }
+    opt->SlantMethod = getSlantMethod(Slant);
+  }
+
+  if (Bench) {
+
+    // Same input through every demodulator
+    for (e = 0; DemodNames[e] != NULL; e++) {
+      printf("==== demod %s ====\n", DemodNames[e]);
+      opt->DemodEngine = e;
+      VideoTime   = VideoLength = 0;
+      for (i = 1; i < argc; i++)
+        decodeFile(d, argv[i]);
+      BenchTime[e] = VideoTime;
+    }
+
+    printf("\n%-8s %10s %10s\n", "demod", "video s", "realtime");
+    for (e = 0; DemodNames[e] != NULL; e++)
+      printf("%-8s %10.2f %9.1fx\n", DemodNames[e], BenchTime[e],
+          BenchTime[e] > 0 ? VideoLength / BenchTime[e] : 0);
+
+  } else {
+
+    for (i = 1; i < argc; i++)
+      decodeFile(d, argv[i]);
+
+  }
+
+  freeDecoder(d);
+  freeFFT();
+
+  return (EXIT_SUCCESS);
+}
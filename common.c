@@ -1,48 +1,167 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
-#include <gtk/gtk.h>
-#include <alsa/asoundlib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include <fftw3.h>
 
 #include "common.h"
 
-gboolean     Abort           = FALSE;
-gboolean     Adaptive        = TRUE;
-gboolean    *HasSync         = NULL;
-gshort       HedrShift       = 0;
-gboolean     ManualActivated = FALSE;
-gboolean     ManualResync    = FALSE;
-guchar      *StoredLum       = NULL;
+char        *DemodNames[]    = { [DEMOD_FFT] = "fft", [DEMOD_SDFT] = "sdft",
+                                 [DEMOD_HILBERT] = "hilbert", NULL };
+char        *SlantNames[]    = { [SLANT_HOUGH] = "hough", [SLANT_FIT] = "fit", [SLANT_TRACK] = "track", NULL };
 
-pthread_t    thread1;
+// Return the FFT bin index matching the given frequency
+guint GetBin (Decoder *d, double Freq, guint FFTLen) {
+  return (Freq / d->SampleRate * FFTLen);
+}
+
+// Samples at the decoder's rate lasting as long as Len samples at 44100 Hz
+int scaleLen (Decoder *d, int Len) {
+  return round(Len * d->SampleRate / 44100);
+}
+
+// Shortest FFT with bins as narrow as those of a Len-point FFT at 44100 Hz
+guint scaleFFT (Decoder *d, guint Len) {
+  guint n;
+  for (n = 16; n < Len * d->SampleRate / 44100 && n < FFT_MAXLEN; n *= 2) ;
+  return n;
+}
 
-FFTStuff     fft;
-GuiObjs      gui;
-PicMeta      CurrentPic;
-PcmData      pcm;
+// Look up a demodulator by name; -1 if there's no such thing
+int getDemodEngine (char *name) {
+  int i;
+  for (i = 0; DemodNames[i] != NULL; i++)
+    if (strcmp(name, DemodNames[i]) == 0) return i;
+  return -1;
+}
 
-GdkPixbuf   *pixbuf_rx       = NULL;
-GdkPixbuf   *pixbuf_disp     = NULL;
-GdkPixbuf   *pixbuf_PWR      = NULL;
-GdkPixbuf   *pixbuf_SNR      = NULL;
+// Look up a slant estimator by name; -1 if there's no such thing
+int getSlantMethod (char *name) {
+  int i;
+  for (i = 0; SlantNames[i] != NULL; i++)
+    if (strcmp(name, SlantNames[i]) == 0) return i;
+  return -1;
+}
 
-GtkListStore *savedstore     = NULL;
+/* Make room for the sync decisions of one picture
+ *  Soft:  also keep 8-bit power ratios for FindSync()
+ */
+void allocSync (Decoder *d, guchar Mode, gboolean Soft) {
 
-GKeyFile    *config          = NULL;
+  d->SyncLen = ModeSpec[Mode].LineTime * ModeSpec[Mode].NumLines / SYNCHOP + 1;
+  d->SyncHop = SYNCHOP * d->SampleRate;
 
-// Return the FFT bin index matching the given frequency
-guint GetBin (double Freq, guint FFTLen) {
-  return (Freq / 44100 * FFTLen);
+  d->HasSync = calloc(d->SyncLen / 8 + 1, 1);
+  if (d->HasSync == NULL) {
+    perror("allocSync: Unable to allocate memory for sync signal");
+    exit(EXIT_FAILURE);
+  }
+
+  d->SyncSoft = NULL;
+  if (Soft) {
+    d->SyncSoft = calloc(d->SyncLen, 1);
+    if (d->SyncSoft == NULL) {
+      perror("allocSync: Unable to allocate memory for sync signal");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // One pulse per line, with room for some false ones
+  d->PulseRoom     = ModeSpec[Mode].NumLines * 2 + 64;
+  d->NumSyncPulses = 0;
+  d->SyncPulse     = malloc(sizeof(double) * d->PulseRoom);
+  d->SyncPulseFreq = malloc(sizeof(double) * d->PulseRoom);
+  if (d->SyncPulse == NULL || d->SyncPulseFreq == NULL) {
+    perror("allocSync: Unable to allocate memory for sync signal");
+    exit(EXIT_FAILURE);
+  }
+}
+
+void freeSync (Decoder *d) {
+  free(d->HasSync);
+  free(d->SyncSoft);
+  free(d->SyncPulse);
+  free(d->SyncPulseFreq);
+  d->HasSync       = NULL;
+  d->SyncSoft      = NULL;
+  d->SyncPulse     = NULL;
+  d->SyncPulseFreq = NULL;
+  d->SyncLen       = 0;
+  d->NumSyncPulses = 0;
+}
+
+/* Record decision n: sync if there's more than twice the power per Hz in
+ * the sync band than in the video band. The soft level is the ratio in
+ * 1/8 dB steps around 128.
+ */
+void storeSync (Decoder *d, int n, double Psync, double Pvideo) {
+
+  if (n < 0 || n >= d->SyncLen) return;
+
+  if (Psync > 2*Pvideo) d->HasSync[n >> 3] |=  (1 << (n & 7));
+  else                  d->HasSync[n >> 3] &= ~(1 << (n & 7));
+
+  if (d->SyncSoft != NULL)
+    d->SyncSoft[n] = clip(128 + 80 * log10((Psync + 1e-12) / (Pvideo + 1e-12)));
+}
+
+// Record a sync pulse starting at sample Start; any beyond the room are dropped
+void storePulse (Decoder *d, double Start, double Freq) {
+  if (d->SyncPulse == NULL || d->NumSyncPulses == d->PulseRoom) return;
+  d->SyncPulse[d->NumSyncPulses]     = Start;
+  d->SyncPulseFreq[d->NumSyncPulses] = Freq;
+  d->NumSyncPulses ++;
+}
+
+// Hard sync decision n; no sync outside the picture
+gboolean getSync (Decoder *d, int n) {
+  if (n < 0 || n >= d->SyncLen) return FALSE;
+  return (d->HasSync[n >> 3] >> (n & 7)) & 1;
+}
+
+// First sync decision from n on, SyncLen if there's none; skips empty bytes
+int nextSync (Decoder *d, int n) {
+  if (n < 0) n = 0;
+  while (n < d->SyncLen) {
+    if ((n & 7) == 0 && d->HasSync[n >> 3] == 0) n += 8;
+    else if (getSync(d, n))                      return n;
+    else                                         n ++;
+  }
+  return d->SyncLen;
+}
+
+// Soft sync level n, 0..255; just 0 or 255 without a soft track
+guchar getSyncLevel (Decoder *d, int n) {
+  if (n < 0 || n >= d->SyncLen) return 0;
+  if (d->SyncSoft != NULL) return d->SyncSoft[n];
+  return (getSync(d, n) ? 255 : 0);
+}
+
+/* Where between decisions n and n+1 the soft level crosses the sync
+ * threshold, 0..1 from n; halfway without a soft track
+ */
+double getSyncEdge (Decoder *d, int n) {
+
+  double a, b;
+
+  if (d->SyncSoft == NULL || n < 0 || n + 1 >= d->SyncLen) return 0.5;
+
+  // storeSync() puts a power ratio of 2 at 128 + 80 log10(2)
+  a = d->SyncSoft[n]   - (128 + 80 * log10(2));
+  b = d->SyncSoft[n+1] - (128 + 80 * log10(2));
+  if ((a < 0) == (b < 0)) return 0.5;
+
+  return a / (a - b);
 }
 
 // Sinusoid power from complex DFT coefficients
-double power (fftw_complex coeff) {
-  return pow(coeff[0],2) + pow(coeff[1],2);
+dsp_t power (dsp_complex coeff) {
+  return coeff[0] * coeff[0] + coeff[1] * coeff[1];
 }
 
 // Clip to [0..255]
@@ -74,142 +193,21 @@ void ensure_dir_exists(const char *dir) {
   }
 }
 
-// Save current picture as PNG
-void saveCurrentPic() {
+// Save the current picture as PNG in dir
+void savePic(Decoder *d, char *dir) {
   GdkPixbuf *scaledpb;
   GString   *pngfilename;
+  PicMeta   *Pic = &d->CurrentPic;
 
-  pngfilename = g_string_new(g_key_file_get_string(config,"slowrx","rxdir",NULL));
-  g_string_append_printf(pngfilename, "/%s_%s.png", CurrentPic.timestr, ModeSpec[CurrentPic.Mode].ShortName);
+  pngfilename = g_string_new(dir);
+  g_string_append_printf(pngfilename, "/%s_%s.png", Pic->timestr, ModeSpec[Pic->Mode].ShortName);
   printf("  Saving to %s\n", pngfilename->str);
 
-  scaledpb = gdk_pixbuf_scale_simple (pixbuf_rx, ModeSpec[CurrentPic.Mode].ImgWidth,
-    ModeSpec[CurrentPic.Mode].NumLines * ModeSpec[CurrentPic.Mode].LineHeight, GDK_INTERP_HYPER);
+  scaledpb = gdk_pixbuf_scale_simple (Pic->pixbuf, ModeSpec[Pic->Mode].ImgWidth,
+    ModeSpec[Pic->Mode].NumLines * ModeSpec[Pic->Mode].LineHeight, GDK_INTERP_HYPER);
 
-  ensure_dir_exists(g_key_file_get_string(config,"slowrx","rxdir",NULL));
+  ensure_dir_exists(dir);
   gdk_pixbuf_savev(scaledpb, pngfilename->str, "png", NULL, NULL, NULL);
   g_object_unref(scaledpb);
   g_string_free(pngfilename, TRUE);
 }
-
-
-/*** Gtk+ event handlers ***/
-
-
-// Quit
-void evt_deletewindow() {
-  gtk_main_quit ();
-}
-
-// Transform the NoiseAdapt toggle state into a variable
-void evt_GetAdaptive() {
-  Adaptive = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(gui.tog_adapt));
-}
-
-// Manual Start clicked
-void evt_ManualStart() {
-  ManualActivated = TRUE;
-}
-
-// Abort clicked during rx
-void evt_AbortRx() {
-  Abort = TRUE;
-}
-
-// Another device selected from list
-void evt_changeDevices() {
-
-  int status;
-
-  pcm.BufferDrop = FALSE;
-  Abort = TRUE;
-
-  static int init;
-  if (init)
-    pthread_join(thread1, NULL);
-  init = 1;
-
-  if (pcm.handle != NULL) snd_pcm_close(pcm.handle);
-
-  status = initPcmDevice(gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(gui.combo_card)));
-
-
-  switch(status) {
-    case 0:
-      gtk_image_set_from_stock(GTK_IMAGE(gui.image_devstatus),GTK_STOCK_YES,GTK_ICON_SIZE_SMALL_TOOLBAR);
-      gtk_widget_set_tooltip_text(gui.image_devstatus, "Device successfully opened");
-      break;
-    case -1:
-      gtk_image_set_from_stock(GTK_IMAGE(gui.image_devstatus),GTK_STOCK_DIALOG_WARNING,GTK_ICON_SIZE_SMALL_TOOLBAR);
-      gtk_widget_set_tooltip_text(gui.image_devstatus, "Device was opened, but doesn't support 44100 Hz");
-      break;
-    case -2:
-      gtk_image_set_from_stock(GTK_IMAGE(gui.image_devstatus),GTK_STOCK_DIALOG_ERROR,GTK_ICON_SIZE_SMALL_TOOLBAR);
-      gtk_widget_set_tooltip_text(gui.image_devstatus, "Failed to open device");
-      break;
-  }
-
-  g_key_file_set_string(config,"slowrx","device",gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(gui.combo_card)));
-
-  pthread_create (&thread1, NULL, Listen, NULL);
-
-}
-
-// Clear received picture & metadata
-void evt_clearPix() {
-  gdk_pixbuf_fill (pixbuf_disp, 0);
-  gtk_image_set_from_pixbuf(GTK_IMAGE(gui.image_rx), pixbuf_disp);
-  gtk_label_set_markup (GTK_LABEL(gui.label_fskid), "");
-  gtk_label_set_markup (GTK_LABEL(gui.label_utc), "");
-  gtk_label_set_markup (GTK_LABEL(gui.label_lastmode), "");
-}
-
-// Manual slant adjust
-void evt_clickimg(GtkWidget *widget, GdkEventButton* event, GdkWindowEdge edge) {
-  static double prevx=0,prevy=0,newrate;
-  static gboolean   secondpress=FALSE;
-  double        x,y,dx,dy,xic;
-
-  (void)widget;
-  (void)edge;
-
-  if (event->type == GDK_BUTTON_PRESS && event->button == 1 && gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(gui.tog_setedge))) {
-
-    x = event->x * (ModeSpec[CurrentPic.Mode].ImgWidth / 500.0);
-    y = event->y * (ModeSpec[CurrentPic.Mode].ImgWidth / 500.0) / ModeSpec[CurrentPic.Mode].LineHeight;
-
-    if (secondpress) {
-      secondpress=FALSE;
-
-      dx = x - prevx;
-      dy = y - prevy;
-
-      gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(gui.tog_setedge),FALSE);
-
-      // Adjust sample rate, if in sensible limits
-      newrate = CurrentPic.Rate + CurrentPic.Rate * (dx * ModeSpec[CurrentPic.Mode].PixelTime) / (dy * ModeSpec[CurrentPic.Mode].LineHeight * ModeSpec[CurrentPic.Mode].LineTime);
-      if (newrate > 32000 && newrate < 56000) {
-        CurrentPic.Rate = newrate;
-
-        // Find x-intercept and adjust skip
-        xic = fmod( (x - (y / (dy/dx))), ModeSpec[CurrentPic.Mode].ImgWidth);
-        if (xic < 0) xic = ModeSpec[CurrentPic.Mode].ImgWidth - xic;
-        CurrentPic.Skip = fmod(CurrentPic.Skip + xic * ModeSpec[CurrentPic.Mode].PixelTime * CurrentPic.Rate,
-          ModeSpec[CurrentPic.Mode].LineTime * CurrentPic.Rate);
-        if (CurrentPic.Skip > ModeSpec[CurrentPic.Mode].LineTime * CurrentPic.Rate / 2.0)
-          CurrentPic.Skip -= ModeSpec[CurrentPic.Mode].LineTime * CurrentPic.Rate;
-
-        // Signal the listener to exit from GetVIS() and re-process the pic
-        ManualResync = TRUE;
-      }
-
-    } else {
-      secondpress = TRUE;
-      prevx = x;
-      prevy = y;
-    }
-  } else {
-    secondpress=FALSE;
-    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(gui.tog_setedge), FALSE);
-  }
-}
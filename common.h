@@ -1,151 +1,302 @@
 #ifndef _COMMON_H_
 #define _COMMON_H_
 
+#include <pthread.h>
+
+#include "libslowrx.h"
+
 #define MINSLANT 30
 #define MAXSLANT 150
 #define BUFLEN   4096
 #define SYNCPIXLEN 1.5e-3
+#define FFT_MAXLEN 4096
+#define SYNCHOP  (13/44100.0)       // seconds between sync decisions
+#define LUMHOP   6                  // samples at 44100 Hz between demodulated frequencies
+#define LUM_ONE  256                // one step of luminance in StoredLum
+#define HANN_LENS { 48, 64, 96, 128, 256, 512, 1024 }  // video windows at 44100 Hz
+#define GOERTZEL_MAXFREQS 8
 
-extern gboolean   Abort;
-extern gboolean   Adaptive;
-extern gboolean  *HasSync;
-extern gboolean   ManualActivated;
-extern gboolean   ManualResync;
-extern guchar    *StoredLum;
-extern pthread_t  thread1;
 extern guchar     VISmap[];
 
+// FFTW for dsp_t; make FLOAT=1 for single precision
+#ifdef SLOWRX_FLOAT
+#define FFTW(name)     fftwf_ ## name
+#else
+#define FFTW(name)     fftw_ ## name
+#endif
+typedef FFTW(complex)  dsp_complex;
+typedef FFTW(plan)     dsp_plan;
+
 typedef struct _FFTStuff FFTStuff;
 struct _FFTStuff {
-  double       *in;
-  fftw_complex *out;
-  fftw_plan     Plan1024;
-  fftw_plan     Plan2048;
+  dsp_t       *in;
+  dsp_complex *out;
+  int          Used;                // in may be nonzero below this
+};
+
+#define SDFT_MAXBINS 64
+
+typedef struct _SlidingDFT SlidingDFT;
+struct _SlidingDFT {
+  int    WinLen;
+  guint  LoBin, HiBin;
+  int    Age;                       // samples slid since the last direct computation
+  double Re[SDFT_MAXBINS][3],    Im[SDFT_MAXBINS][3];     // running sums at w-d, w, w+d
+  double RotRe[SDFT_MAXBINS][3], RotIm[SDFT_MAXBINS][3];  // e^(jw)
+  double EndRe[SDFT_MAXBINS][3], EndIm[SDFT_MAXBINS][3];  // e^(-jw(N-1))
+};
+
+// Band-limited spectrum by chirp-z transform
+typedef struct _ZoomFFT ZoomFFT;
+struct _ZoomFFT {
+  int           WinLen;             // 0 = not in use, do a full FFT instead
+  int           L;                  // length of the internal complex FFTs
+  guint         LoBin, NumBins;
+  dsp_complex  *Pre;                // window * shift * chirp
+  dsp_complex  *Kern;               // transformed chirp
+  dsp_complex  *buf;
+  dsp_plan      Fwd, Inv;           // shared, from getComplexPlan()
+};
+
+// Running band powers for the SNR estimate
+#define SNR_STAGES 3
+
+typedef struct _SNREstimator SNREstimator;
+struct _SNREstimator {
+  double B0[3], A1[3], A2[3];       // noise below, video, noise above
+  double Z[3][SNR_STAGES][2];       // biquad states per band
+  double Power[3];
+  double ENBW[3];                   // equivalent noise bandwidths in Hz
+  double AvgLen;                    // of the moving averages, in samples
+};
+
+#define HILBERT_TAPS 97
+#define HILBERT_LEAD 512          // how far ahead of the window center the filter runs
+#define HILBERT_HIST 2048
+
+typedef struct _HilbertDemod HilbertDemod;
+struct _HilbertDemod {
+  double Rate;
+  double TapRe[HILBERT_TAPS], TapIm[HILBERT_TAPS];  // complex band-pass = band-pass + Hilbert
+  guint  Count;                     // samples demodulated so far
+  int    AvgLen;                    // phase differences averaged, 0 = not primed
+  int    Age;
+  double ZRe[HILBERT_HIST],  ZIm[HILBERT_HIST];     // analytic signal
+  double DRe[HILBERT_HIST],  DIm[HILBERT_HIST];     // z[n] conj(z[n-1])
+  double SumRe, SumIm;
+};
+
+// Matched filter for the sync pulses
+typedef struct _PulseFilter PulseFilter;
+struct _PulseFilter {
+  int           Len;                // pulse length in samples
+  double        Rate;
+  double        Freq;
+  int           N;                  // FFT length
+  int           Fill;               // samples in x, history included
+  int           Count;              // sample number of x[0]
+  dsp_t        *x;
+  dsp_complex  *Kern;               // transformed time-reversed conjugate burst
+  dsp_complex  *buf;
+  dsp_plan      Fwd, Inv;           // shared, from getComplexPlan()
+  double       *Mag;                // recent |y|, by output number & MagMask
+  int           MagMask;
+  int           Last;               // latest output
+  gint16       *Raw;                // recent samples, by sample number & RawMask
+  int           RawMask;
+  int           Fed;                // samples fed
+  double        PeakRho;            // best candidate so far, 0 = none
+  int           PeakPos;
+  Decoder      *Dec;                // where the pulses go
+};
+
+// Pulse sequences followed at once by fitSlant() and the running line fit
+#define FIT_CHAINS 16
+
+typedef struct _PulseChain PulseChain;
+struct _PulseChain {
+  int      Len;                     // pulses
+  double   t0;                      // first pulse; times are kept relative to it
+  double   Sn, St, Snn, Snt;        // least squares sums over line number n and time t
+  double   LastT;
+  int      LastLine;
+};
+
+typedef struct _SlantTracker SlantTracker;
+struct _SlantTracker {
+  guchar      Mode;
+  double      P, PulseLen, MaxDrift;
+  double      Shift;
+  int         Done;                 // pulses looked at
+  int         NumChains, Best;
+  PulseChain  Chain[FIT_CHAINS];
 };
-extern FFTStuff fft;
 
 typedef struct _PcmData PcmData;
 struct _PcmData {
-  snd_pcm_t *handle;
+  PcmSource *Source;
   gint16    *Buffer;
   int        WindowPtr;
   gboolean   BufferDrop;
-};
-extern PcmData pcm;
-
-typedef struct _GuiObjs GuiObjs;
-struct _GuiObjs {
-  GtkWidget *button_abort;
-  GtkWidget *button_browse;
-  GtkWidget *button_clear;
-  GtkWidget *button_start;
-  GtkWidget *combo_card;
-  GtkWidget *combo_mode;
-  GtkWidget *entry_picdir;
-  GtkWidget *eventbox_img;
-  GtkWidget *frame_manual;
-  GtkWidget *frame_slant;
-  GtkWidget *grid_vu;
-  GtkWidget *iconview;
-  GtkWidget *image_devstatus;
-  GtkWidget *image_pwr;
-  GtkWidget *image_rx;
-  GtkWidget *image_snr;
-  GtkWidget *label_fskid;
-  GtkWidget *label_lastmode;
-  GtkWidget *label_utc;
-  GtkWidget *menuitem_about;
-  GtkWidget *menuitem_quit;
-  GtkWidget *spin_shift;
-  GtkWidget *statusbar;
-  GtkWidget *tog_adapt;
-  GtkWidget *tog_fsk;
-  GtkWidget *tog_rx;
-  GtkWidget *tog_save;
-  GtkWidget *tog_setedge;
-  GtkWidget *tog_slant;
-  GtkWidget *window_about;
-  GtkWidget *window_main;
-};
-extern GuiObjs   gui;
+  gboolean   EndOfStream;
+  guint64    SamplesRead;
 
-extern GdkPixbuf *pixbuf_PWR;
-extern GdkPixbuf *pixbuf_SNR;
-extern GdkPixbuf *pixbuf_rx;
-extern GdkPixbuf *pixbuf_disp;
+  // Ring filled by the capture thread
+  gint16       *Ring;
+  volatile gint Head;               // written by the capture thread only
+  volatile gint Tail;               // written by the decoder thread only
+  volatile gint CaptureEOF, CaptureQuit, CapturePaused;
+  pthread_t     CaptureThread;
+  gboolean      Capturing;
 
-extern GtkListStore *savedstore;
+  // Decimation by the capture thread, polyphase: only every Factor-th output is computed
+  int           Factor;             // source samples per decoder sample
+  int           NumTaps;
+  dsp_t        *Taps;
+  dsp_t        *Hist;               // last NumTaps-1 source samples, then room for a chunk
+  int           Phase;              // source samples to go until the next output
+};
 
-extern GKeyFile  *config;
+// A recording opened for the channelizer
+typedef struct _PcmFile PcmFile;
 
+#define BANK_OVER  4                // channel rate / channel spacing, at least
+#define BANK_RING  65536            // decoder samples buffered per channel
 
-typedef struct _PicMeta PicMeta;
-struct _PicMeta {
-  gshort HedrShift;
-  guchar Mode;
-  double Rate;
-  int    Skip;
-  GdkPixbuf *thumbbuf;
-  char   timestr[40];
+// One channel of a ChannelBank, read by a decoder as a PcmSource
+typedef struct _BankChannel BankChannel;
+struct _BankChannel {
+  ChannelBank  *Bank;
+  int           Bin;                // of the inverse FFT
+  double        Center;             // Hz in the recording
+  gboolean      Open;
+  PcmSource     Source;
+  gint16       *Ring;               // audio at ChanRate, center at CHANNEL_AUDIO
+  guint64       Head, Taken;
+  double        Phase;              // of the CHANNEL_AUDIO carrier, in cycles
 };
-extern PicMeta CurrentPic;
-
-// SSTV modes
-enum {
-  UNKNOWN=0,
-  M1,    M2,   M3,    M4,
-  S1,    S2,   SDX,
-  R72,   R36,  R24,   R24BW, R12BW, R8BW,
-  PD50,  PD90, PD120, PD160, PD180, PD240, PD290,
-  P3,    P5,   P7,
-  W2120, W2180
+
+// Polyphase filter bank splitting a recording into channels
+struct _ChannelBank {
+  PcmFile      *File;
+  gboolean      Complex;            // IQ, not audio
+  double        Rate;               // of the recording
+  double        Spacing;            // Rate / M
+  double        ChanRate;           // Rate / D, at least BANK_OVER * Spacing
+  double        Base;               // frequency moved to 0 Hz before filtering
+  double        MixPhase;           // of that shift, in cycles
+  double        Gain;
+  int           M, D, L;            // branches, decimation, prototype taps
+  dsp_t        *h;                  // prototype low-pass
+  dsp_complex  *x;                  // last L input samples, newest last, then room for D more
+  dsp_complex  *Twiddle;            // e^(-j 2pi i/M)
+  dsp_complex  *buf;
+  dsp_plan      Inv;                // shared, from getComplexPlan()
+  guint64       Blocks;             // inverse FFTs done
+  guint64       Fed;                // input samples
+  gboolean      EndOfFile;
+  int           NumChannels;
+  BankChannel  *Channels;
+  pthread_mutex_t Lock;
 };
 
-// Color encodings
-enum {
-  GBR, RGB, YUV, BW
+// Everything one decoder knows
+struct _Decoder {
+  DecoderOptions    Options;
+  DecoderCallbacks  Callbacks;
+  void             *User;
+
+  // Requests from other threads
+  volatile gboolean Abort;
+  volatile gboolean ManualActivated;
+  volatile gboolean ManualResync;
+  guchar            ManualMode;
+  gshort            ManualShift;
+
+  PcmData           pcm;
+  PcmSource        *FileSource;     // opened by initPcmFile()
+  double            SampleRate;     // of the samples in the ring, after decimation
+  double            SyncHop;        // samples between sync decisions
+  FFTStuff          fft;
+  PicMeta           CurrentPic;
+  guint16          *StoredLum;      // luminance * LUM_ONE every LumHop samples of the picture
+  int               LumHop;
+  int               LumLen;
+
+  guchar           *HasSync;        // sync decisions every 13 samples, one bit each
+  guchar           *SyncSoft;       // optional sync-to-video power ratio per decision, or NULL
+  int               SyncLen;
+  double           *SyncPulse;      // sync pulse start times in samples, from the matched filter
+  double           *SyncPulseFreq;  // and their frequencies in Hz
+  int               NumSyncPulses;
+  int               PulseRoom;
+  SlantTracker      Track;
+
+  pthread_mutex_t   PicLock;        // held while the picture is received or redrawn
 };
 
-typedef struct ModeSpec {
-  char   *Name;
-  char   *ShortName;
-  double  SyncTime;
-  double  PorchTime;
-  double  SeptrTime;
-  double  PixelTime;
-  double  LineTime;
-  gushort ImgWidth;
-  gushort NumLines;
-  guchar  LineHeight;
-  guchar  ColorEnc;
-} _ModeSpec;
-
-extern _ModeSpec ModeSpec[];
-
-double   power     (fftw_complex coeff);
+
+dsp_t    power         (dsp_complex coeff);
 guchar   clip          (double a);
-void     createGUI     ();
 double   deg2rad       (double Deg);
-double   FindSync      (guchar Mode, double Rate, int *Skip);
-void     GetFSK        (char *dest);
-gboolean GetVideo      (guchar Mode, double Rate, int Skip, gboolean Redraw);
-guchar   GetVIS        ();
-guint    GetBin        (double Freq, guint FFTLen);
-int      initPcmDevice ();
-void     *Listen       ();
-void     populateDeviceList ();
-void     readPcm       (gint numsamples);
-void     saveCurrentPic();
-void     setVU         (double *Power, int FFTLen, int WinIdx, gboolean ShowWin);
-
-void     evt_AbortRx       ();
-void     evt_changeDevices ();
-void     evt_chooseDir     ();
-void     evt_clearPix      ();
-void     evt_clickimg      ();
-void     evt_deletewindow  ();
-void     evt_GetAdaptive   ();
-void     evt_ManualStart   ();
-void     evt_show_about    ();
+double   rad2deg       (double rad);
+double   FindSync      (Decoder *d, guchar Mode, double Rate, int *Skip);
+void     GetFSK        (Decoder *d, char *dest);
+gboolean GetVideo      (Decoder *d, guchar Mode, double Rate, int Skip, gboolean Redraw);
+void     drawVideo     (Decoder *d, guchar Mode, double Rate, int Skip, GdkPixbuf *dest);
+guchar   GetVIS        (Decoder *d);
+guint    GetBin        (Decoder *d, double Freq, guint FFTLen);
+int      scaleLen      (Decoder *d, int Len);
+guint    scaleFFT      (Decoder *d, guint Len);
+void     kaiserLowpass (dsp_t *h, int L, double Cutoff, double Atten);
+void     initSDFT      (SlidingDFT *s, gint16 *center, int WinLen, guint FFTLen, guint LoBin, guint HiBin);
+void     powerSDFT     (SlidingDFT *s, dsp_t *Power);
+void     slideSDFT     (SlidingDFT *s, gint16 *center);
+void     goertzel      (gint16 *Samples, dsp_t *Window, int WinLen, int NumFreqs, double *Coeff, double *Power);
+guint    peakBin       (dsp_t *Power, guint Lo, guint Hi);
+double   peakInterp    (dsp_t *Power, guint Bin);
+guint    powerPeak     (dsp_complex *X, dsp_t *Power, guint Lo, guint Hi);
+void     powerSpectrum (dsp_complex *X, dsp_t *Power, guint Lo, guint Hi);
+void     windowFFT     (FFTStuff *f, gint16 *Samples, dsp_t *Window, int WinLen);
+void     allocFFTBuffers(FFTStuff *f);
+void     freeFFTBuffers(FFTStuff *f);
+dsp_plan getComplexPlan(guint Len, int Sign);
+dsp_plan getPlan       (guint Len);
+void     planSizes     (Decoder *d);
+void     freeZoomFFT   (ZoomFFT *z);
+gboolean initZoomFFT   (ZoomFFT *z, dsp_t *Window, int WinLen, guint FFTLen, guint LoBin, guint HiBin);
+void     zoomPower     (ZoomFFT *z, gint16 *center, dsp_t *Power);
+double   getSNR        (SNREstimator *e);
+void     initSNR       (SNREstimator *e, double Rate, int HedrShift);
+void     updateSNR     (SNREstimator *e, gint16 sample);
+double   hilbertFreq   (HilbertDemod *h, gint16 *center, int AvgLen);
+void     initHilbert   (HilbertDemod *h, double Rate, double CenterFreq);
+void     allocSync     (Decoder *d, guchar Mode, gboolean Soft);
+void     freeSync      (Decoder *d);
+gboolean getSync       (Decoder *d, int n);
+guchar   getSyncLevel  (Decoder *d, int n);
+int      nextSync      (Decoder *d, int n);
+double   getSyncEdge   (Decoder *d, int n);
+void     storeSync     (Decoder *d, int n, double Psync, double Pvideo);
+void     storePulse    (Decoder *d, double Start, double Freq);
+void     feedPulse     (PulseFilter *p, gint16 sample);
+void     flushPulse    (PulseFilter *p);
+void     freePulse     (PulseFilter *p);
+void     initPulse     (PulseFilter *p, Decoder *d, double PulseTime, double Freq);
+double   getTrackedShift(Decoder *d);
+void     initSlantTracker(Decoder *d, guchar Mode, double Rate, double Shift);
+void     trackSlant    (Decoder *d);
+PcmFile *openWideFile  (char *filename, char *format, int *rate, gboolean *Complex);
+int      readWide      (PcmFile *f, dsp_complex *dest, int numsamples);
+void     closeWideFile (PcmFile *f);
+void     freePcm       (Decoder *d);
+void     readPcm       (Decoder *d, gint numsamples);
+void     startPcm      (Decoder *d);
+void     stopPcm       (Decoder *d);
+
+// Front-end callbacks, if set
+void     showImage     (Decoder *d, int y);
+void     showStatus    (Decoder *d, char *text);
+void     setVU         (Decoder *d, dsp_t *Power, int FFTLen, int WinIdx, gboolean ShowWin);
 
 #endif
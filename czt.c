@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Zoom FFT of the video band (chirp-z transform, Bluestein's algorithm)
+ *
+ * Computes bins LoBin..HiBin of the zero-padded FFTLen-point DFT of a
+ * windowed WinLen-sample frame, without the padding. With km = (k^2 + m^2 -
+ * (k-m)^2)/2 the DFT becomes a convolution with the chirp e^(j pi n^2/FFTLen),
+ * done as a complex FFT of only L >= WinLen + NumBins - 1 points.
+ *
+ * The post-chirp is left out since only power is needed.
+ * Only worth it for the short windows; initZoomFFT() says when it isn't.
+ *
+ */
+
+// Phase of e^(-j 2pi a/b) with a reduced first, so big products stay exact
+static void cisfrac(guint64 a, guint64 b, double scale, dsp_complex out) {
+  double ph = -2 * M_PI * (double)(a % b) / b;
+  out[0] = scale * cos(ph);
+  out[1] = scale * sin(ph);
+}
+
+/* Prepare for frames of WinLen samples weighted by Window[]
+ * returns: FALSE (and leaves z unused) if a plain FFTLen-point FFT is cheaper
+ */
+gboolean initZoomFFT(ZoomFFT *z, dsp_t *Window, int WinLen, guint FFTLen, guint LoBin, guint HiBin) {
+
+  int           m, n, L;
+  guint         NumBins = HiBin - LoBin + 1;
+
+  z->WinLen = 0;
+
+  for (L = 1; L < WinLen + (int)NumBins - 1; L *= 2) ;
+
+  // Two complex L-point FFTs vs. one real FFTLen-point FFT
+  if (2 * 2 * L * log2(L) >= FFTLen * log2(FFTLen)) return FALSE;
+
+  z->L       = L;
+  z->LoBin   = LoBin;
+  z->NumBins = NumBins;
+  z->Pre     = FFTW(alloc_complex)(WinLen);
+  z->Kern    = FFTW(alloc_complex)(L);
+  z->buf     = FFTW(alloc_complex)(L);
+  if (z->Pre == NULL || z->Kern == NULL || z->buf == NULL) {
+    perror("initZoomFFT: Unable to allocate memory for zoom FFT");
+    exit(EXIT_FAILURE);
+  }
+
+  // Window, shift down by LoBin and pre-chirp in one go: w[m] e^(-j 2pi (LoBin m + m^2/2) / FFTLen)
+  for (m = 0; m < WinLen; m++)
+    cisfrac(2ULL * LoBin * m + (guint64)m * m, 2ULL * FFTLen, Window[m] / 32768.0, z->Pre[m]);
+
+  // Chirp e^(j pi n^2/FFTLen) for n = -(WinLen-1)..NumBins-1, wrapped around L
+  z->Fwd = getComplexPlan(L, FFTW_FORWARD);
+  z->Inv = getComplexPlan(L, FFTW_BACKWARD);
+
+  for (n = 0; n < L; n++) z->Kern[n][0] = z->Kern[n][1] = 0;
+  for (n = -(WinLen-1); n < (int)NumBins; n++) {
+    cisfrac((guint64)(n * n), 2ULL * FFTLen, 1.0, z->Kern[(n + L) % L]);
+    z->Kern[(n + L) % L][1] *= -1;
+  }
+  FFTW(execute_dft)(z->Fwd, z->Kern, z->Kern);
+
+  z->WinLen = WinLen;
+
+  return TRUE;
+}
+
+void freeZoomFFT(ZoomFFT *z) {
+
+  if (z->WinLen == 0) return;
+
+  FFTW(free)(z->Pre);
+  FFTW(free)(z->Kern);
+  FFTW(free)(z->buf);
+  z->WinLen = 0;
+}
+
+// Power of bins LoBin..HiBin for the frame centered at *center
+void zoomPower(ZoomFFT *z, gint16 *center, dsp_t *Power) {
+
+  int    m, N = z->WinLen;
+  guint  k;
+  dsp_t  re, im;
+
+  for (m = 0; m < N; m++) {
+    z->buf[m][0] = center[m - N/2] * z->Pre[m][0];
+    z->buf[m][1] = center[m - N/2] * z->Pre[m][1];
+  }
+  for (m = N; m < z->L; m++) z->buf[m][0] = z->buf[m][1] = 0;
+
+  FFTW(execute_dft)(z->Fwd, z->buf, z->buf);
+
+  for (m = 0; m < z->L; m++) {
+    re = z->buf[m][0] * z->Kern[m][0] - z->buf[m][1] * z->Kern[m][1];
+    im = z->buf[m][0] * z->Kern[m][1] + z->buf[m][1] * z->Kern[m][0];
+    z->buf[m][0] = re;
+    z->buf[m][1] = im;
+  }
+
+  FFTW(execute_dft)(z->Inv, z->buf, z->buf);
+
+  // The post-chirp e^(-j pi k^2/FFTLen) has no effect on power; 1/L is from the inverse FFT
+  for (k = 0; k < z->NumBins; k++)
+    Power[z->LoBin + k] = power(z->buf[k]) / ((double)z->L * z->L);
+}
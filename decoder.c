@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Decoder objects
+ *
+ * A Decoder holds all there is to one stream of audio: its capture ring,
+ * FFT buffers, the picture being received and what's kept of it for the
+ * slant correction. receivePic() goes through one picture from VIS to
+ * final image, telling the front end along the way.
+ *
+ */
+
+/* Make a decoder with no source yet
+ *   Callbacks:  copied; NULL for none
+ *   User:       for the front end, see getUser()
+ */
+Decoder *newDecoder (DecoderCallbacks *Callbacks, void *User) {
+
+  Decoder *d = calloc(1, sizeof(Decoder));
+
+  if (d == NULL) {
+    perror("newDecoder: Unable to allocate memory for decoder");
+    exit(EXIT_FAILURE);
+  }
+
+  if (Callbacks != NULL) d->Callbacks = *Callbacks;
+  d->User = User;
+
+  d->Options.Adaptive    = TRUE;
+  d->Options.DemodEngine = DEMOD_FFT;
+  d->Options.SlantMethod = SLANT_TRACK;
+  d->Options.AutoSlant   = TRUE;
+  d->Options.FSK         = TRUE;
+  d->Options.SoftSync    = TRUE;
+  d->Options.Rate        = 11025;
+
+  allocFFTBuffers(&d->fft);
+  pthread_mutex_init(&d->PicLock, NULL);
+
+  d->SampleRate        = 44100;
+  d->CurrentPic.Rate   = d->SampleRate;
+  d->CurrentPic.pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 320, 256);
+  gdk_pixbuf_fill(d->CurrentPic.pixbuf, 0x000000ff);
+
+  return d;
+}
+
+// Close the source and free everything; the decoder must not be running
+void freeDecoder (Decoder *d) {
+
+  freePcm(d);
+  if (d->FileSource != NULL) {
+    free(d->FileSource->Data);
+    free(d->FileSource);
+  }
+
+  freeFFTBuffers(&d->fft);
+  freeSync(d);
+  free(d->StoredLum);
+  g_object_unref(d->CurrentPic.pixbuf);
+  pthread_mutex_destroy(&d->PicLock);
+  free(d);
+}
+
+DecoderOptions *getOptions (Decoder *d) {
+  return &d->Options;
+}
+
+PicMeta *getPic (Decoder *d) {
+  return &d->CurrentPic;
+}
+
+void *getUser (Decoder *d) {
+  return d->User;
+}
+
+// Samples read from the source so far, at getSampleRate()
+guint64 getSamplesRead (Decoder *d) {
+  return d->pcm.SamplesRead;
+}
+
+// Rate the decoder works at, that of the source after decimation
+double getSampleRate (Decoder *d) {
+  return d->SampleRate;
+}
+
+/* Receive one picture: wait for a VIS header (or a manual start), get the
+ * video, then the FSK ID and the slant correction as the options say
+ *   returns  FALSE if aborted while waiting, or at the end of the stream;
+ *            a picture cut short by the end is still handed over first
+ */
+gboolean receivePic (Decoder *d) {
+
+  PicMeta   *Pic = &d->CurrentPic;
+  guchar     Mode;
+  gboolean   Finished;
+  gint64     VideoStart;
+  time_t     timet;
+  struct tm  tm;
+
+  // Nothing more will come
+  if (d->pcm.EndOfStream) return FALSE;
+
+  startPcm(d);
+  d->Abort = FALSE;
+
+  do {
+
+    // Wait for VIS
+    Mode = GetVIS(d);
+
+    // Stop listening on abort, source error or end of stream
+    if (d->Abort || d->pcm.EndOfStream) return FALSE;
+
+    // If manual resync was requested, redraw image
+    if (d->ManualResync) {
+      d->ManualResync = FALSE;
+      stopPcm(d);
+      printf("getvideo at %.2f skip %d\n", Pic->Rate, Pic->Skip);
+      pthread_mutex_lock(&d->PicLock);
+      GetVideo(d, Pic->Mode, Pic->Rate, Pic->Skip, TRUE);
+      pthread_mutex_unlock(&d->PicLock);
+      if (d->Callbacks.Image != NULL) d->Callbacks.Image(d, TRUE);
+      startPcm(d);
+    }
+
+  } while (Mode == 0);
+
+  // Start reception; no previews until the picture is done
+  pthread_mutex_lock(&d->PicLock);
+
+  Pic->Rate     = d->SampleRate;
+  Pic->Mode     = Mode;
+  Pic->Skip     = 0;
+  Pic->SlantUsed = -1;
+  Pic->fskid[0] = '\0';
+
+  printf("  ==== %s ====\n", ModeSpec[Mode].Name);
+
+  // Store time of reception
+  timet = time(NULL);
+  gmtime_r(&timet, &tm);
+  strftime(Pic->timestr, sizeof(Pic->timestr)-1, "%Y%m%d-%H%M%Sz", &tm);
+
+  // Allocate space for cached Lum, one value per demodulator hop
+  free(d->StoredLum);
+  d->LumHop    = MAX(1, scaleLen(d, LUMHOP));
+  d->LumLen    = (ModeSpec[Mode].LineTime * ModeSpec[Mode].NumLines + 1) * d->SampleRate / d->LumHop + 1;
+  d->StoredLum = calloc(d->LumLen, sizeof(guint16));
+  if (d->StoredLum == NULL) {
+    perror("receivePic: Unable to allocate memory for Lum");
+    exit(EXIT_FAILURE);
+  }
+
+  // Allocate space for sync signal
+  allocSync(d, Mode, d->Options.SoftSync);
+
+  if (d->Callbacks.Start != NULL) d->Callbacks.Start(d);
+
+  printf("  getvideo @ %.1f Hz, Skip %d, HedrShift %+d Hz\n", Pic->Rate, 0, Pic->HedrShift);
+  VideoStart     = g_get_monotonic_time();
+  Finished       = GetVideo(d, Mode, Pic->Rate, 0, FALSE);
+  Pic->VideoTime = (g_get_monotonic_time() - VideoStart) / (double)G_USEC_PER_SEC;
+
+  if (Finished && d->Options.FSK) {
+    showStatus(d, "Receiving FSK ID...");
+    GetFSK(d, Pic->fskid);
+    printf("  FSKID \"%s\"\n", Pic->fskid);
+    if (d->Callbacks.FSKID != NULL) d->Callbacks.FSKID(d, Pic->fskid);
+  }
+
+  stopPcm(d);
+
+  if (Finished && d->Options.AutoSlant) {
+
+    // Fix slant
+    showStatus(d, "Calculating slant...");
+    printf("  FindSync @ %.1f Hz\n", Pic->Rate);
+    Pic->Rate = FindSync(d, Mode, Pic->Rate, &Pic->Skip);
+
+    // Final image
+    printf("  getvideo @ %.1f Hz, Skip %d, HedrShift %+d Hz\n", Pic->Rate, Pic->Skip, Pic->HedrShift);
+    GetVideo(d, Mode, Pic->Rate, Pic->Skip, TRUE);
+  }
+
+  freeSync(d);
+
+  pthread_mutex_unlock(&d->PicLock);
+
+  if (d->Callbacks.Image != NULL) d->Callbacks.Image(d, Finished);
+
+  // The stream may have ended during the picture, which is kept all the same
+  return !d->pcm.EndOfStream;
+}
+
+// Cut the picture short, or stop waiting for one; from any thread
+void abortPic (Decoder *d) {
+  d->Abort = TRUE;
+}
+
+// Start receiving in Mode right away, as if a VIS header had come in
+void startManual (Decoder *d, guchar Mode, gshort HedrShift) {
+  d->ManualMode      = Mode;
+  d->ManualShift     = HedrShift;
+  d->ManualActivated = TRUE;
+}
+
+// Redraw the last picture at another rate and skip, once the decoder is waiting for VIS
+void resyncPic (Decoder *d, double Rate, int Skip) {
+  d->CurrentPic.Rate = Rate;
+  d->CurrentPic.Skip = Skip;
+  d->ManualResync    = TRUE;
+}
+
+
+/* Draw the last picture at another rate and skip into dest, scaled to its
+ * size, for showing while a correction is being picked; from any thread
+ *   dest:     RGB without alpha
+ *   returns   FALSE if a picture is being received or redrawn, or there
+ *             hasn't been one
+ */
+gboolean previewPic (Decoder *d, double Rate, int Skip, GdkPixbuf *dest) {
+
+  if (pthread_mutex_trylock(&d->PicLock) != 0) return FALSE;
+
+  if (d->StoredLum == NULL) {
+    pthread_mutex_unlock(&d->PicLock);
+    return FALSE;
+  }
+
+  drawVideo(d, d->CurrentPic.Mode, Rate, Skip, dest);
+
+  pthread_mutex_unlock(&d->PicLock);
+  return TRUE;
+}
+
+
+/*** Front-end callbacks ***/
+
+void showImage (Decoder *d, int y) {
+  if (d->Callbacks.Line != NULL) d->Callbacks.Line(d, y);
+}
+
+void showStatus (Decoder *d, char *text) {
+  if (d->Callbacks.Status != NULL) d->Callbacks.Status(d, text);
+}
+
+void setVU (Decoder *d, dsp_t *Power, int FFTLen, int WinIdx, gboolean ShowWin) {
+  if (d->Callbacks.VU != NULL) d->Callbacks.VU(d, Power, FFTLen, WinIdx, ShowWin);
+}
@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Inner loops shared by every FFT in the decoder
+ *
+ * The loops are kept simple enough for the compiler to vectorize, and on
+ * x86-64 each one is built twice: for AVX2 and for the SSE2 baseline. The
+ * dynamic loader picks one for the CPU at startup.
+ *
+ */
+
+#if defined(__x86_64__) && defined(__linux__) && (defined(__GNUC__) || defined(__clang__))
+#define DSP_KERNEL __attribute__((target_clones("avx2","default")))
+#else
+#define DSP_KERNEL
+#endif
+
+// dest[i] = src[i] / 32768 * Window[i]
+DSP_KERNEL
+static void convertWindow(dsp_t *restrict dest, const gint16 *restrict src, const dsp_t *restrict Window, int n) {
+  int i;
+  for (i = 0; i < n; i++) dest[i] = src[i] * (dsp_t)(1.0 / 32768) * Window[i];
+}
+
+/* Fill f->in with WinLen windowed samples starting at *Samples, zero-padded
+ * Only what earlier calls left behind the window gets cleared.
+ */
+void windowFFT(FFTStuff *f, gint16 *Samples, dsp_t *Window, int WinLen) {
+
+  convertWindow(f->in, Samples, Window, WinLen);
+
+  if (f->Used > WinLen) memset(f->in + WinLen, 0, sizeof(dsp_t) * (f->Used - WinLen));
+  f->Used = WinLen;
+}
+
+// Power[k] = |X[k]|^2 for Lo <= k <= Hi
+DSP_KERNEL
+void powerSpectrum(dsp_complex *X, dsp_t *Power, guint Lo, guint Hi) {
+  int k, n = Hi - Lo + 1;
+  dsp_t *restrict p = Power + Lo;
+  const dsp_t *restrict x = X[Lo];
+  for (k = 0; k < n; k++) p[k] = x[2*k] * x[2*k] + x[2*k+1] * x[2*k+1];
+}
+
+// Bin with the most power between Lo and Hi (inclusive)
+guint peakBin(dsp_t *Power, guint Lo, guint Hi) {
+  guint k, MaxBin = Lo;
+  for (k = Lo + 1; k <= Hi; k++)
+    if (Power[k] > Power[MaxBin]) MaxBin = k;
+  return MaxBin;
+}
+
+// powerSpectrum() and peakBin() in one pass
+DSP_KERNEL
+guint powerPeak(dsp_complex *X, dsp_t *Power, guint Lo, guint Hi) {
+  guint k, MaxBin = Lo;
+  dsp_t p, Max = -1;
+  for (k = Lo; k <= Hi; k++) {
+    p = Power[k] = X[k][0] * X[k][0] + X[k][1] * X[k][1];
+    if (p > Max) {
+      Max    = p;
+      MaxBin = k;
+    }
+  }
+  return MaxBin;
+}
+
+/* Fractional bin of the peak at Bin by Gaussian interpolation over its
+ * neighbours; Bin itself if they are empty
+ */
+double peakInterp(dsp_t *Power, guint Bin) {
+
+  double a = Power[Bin - 1], b = Power[Bin], c = Power[Bin + 1], d;
+
+  if (a <= 0 || b <= 0 || c <= 0) return Bin;
+
+  d = 2 * log(b * b / (a * c));
+  if (d == 0) return Bin;
+
+  return Bin + log(c / a) / d;
+}
+
+/* Power at NumFreqs frequencies of WinLen windowed samples starting at
+ * *Samples, by Goertzel's algorithm; same scale as powerSpectrum()
+ *  Coeff:  2 cos(2 pi f / SampleRate) for each frequency f
+ */
+void goertzel(gint16 *Samples, dsp_t *Window, int WinLen, int NumFreqs, double *Coeff, double *Power) {
+
+  int    i, k;
+  double v, s0, s1[GOERTZEL_MAXFREQS] = {0}, s2[GOERTZEL_MAXFREQS] = {0};
+
+  for (i = 0; i < WinLen; i++) {
+    v = Samples[i] / 32768.0 * Window[i];
+    for (k = 0; k < NumFreqs; k++) {
+      s0    = v + Coeff[k] * s1[k] - s2[k];
+      s2[k] = s1[k];
+      s1[k] = s0;
+    }
+  }
+
+  for (k = 0; k < NumFreqs; k++)
+    Power[k] = s1[k] * s1[k] + s2[k] * s2[k] - Coeff[k] * s1[k] * s2[k];
+}
+
+// Modified Bessel function of the first kind, for the Kaiser window
+static double besselI0(double x) {
+  double sum = 1, term = 1;
+  int    k;
+
+  for (k = 1; k < 50 && term > 1e-12 * sum; k++) {
+    term *= (x / (2*k)) * (x / (2*k));
+    sum  += term;
+  }
+  return sum;
+}
+
+/* Kaiser-windowed sinc low-pass of L taps, unity gain at DC
+ *  Cutoff:  where the response is halfway down, as a fraction of the sample rate
+ *  Atten:   stop band attenuation in dB, 50 or more; L decides the
+ *           transition band, (Atten - 8) / (14.36 L) of the sample rate
+ */
+void kaiserLowpass(dsp_t *h, int L, double Cutoff, double Atten) {
+
+  double beta = 0.1102 * (Atten - 8.7), t, w, sum = 0;
+  int    i;
+
+  for (i = 0; i < L; i++) {
+    t    = i - (L-1) / 2.0;
+    w    = (L > 1 ? besselI0(beta * sqrt(1 - pow(2*t / (L-1), 2))) / besselI0(beta) : 1);
+    h[i] = w * (t == 0 ? 2*Cutoff : sin(2*M_PI*Cutoff*t) / (M_PI*t));
+    sum += h[i];
+  }
+  for (i = 0; i < L; i++) h[i] /= sum;
+}
@@ -0,0 +1,213 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <pthread.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * FFTW plans
+ *
+ * Every transform size gets its own plan, made the first time it's asked
+ * for. Plans are measured rather than estimated; the measurements are kept
+ * as FFTW wisdom next to slowrx.ini so that only the very first run pays
+ * for them.
+ *
+ * The plans are shared by all decoders, each with its own buffers, and
+ * made under a lock since FFTW's planner isn't thread-safe.
+ *
+ */
+
+#define MAXPLANS 32
+
+static struct {
+  guint     Len;
+  int       Sign;                   // 0 = real input in -> out
+  dsp_plan  Plan;
+} Plans[MAXPLANS];
+static int       NumPlans     = 0;
+static unsigned  PlanFlags    = FFTW_MEASURE;
+static gboolean  NewWisdom    = FALSE;
+static gchar    *WisdomPath   = NULL;
+static pthread_mutex_t PlanLock = PTHREAD_MUTEX_INITIALIZER;
+
+static const struct {
+  char     *Name;
+  unsigned  Flags;
+} Planners[] = {
+  { "estimate",   FFTW_ESTIMATE   },
+  { "measure",    FFTW_MEASURE    },
+  { "patient",    FFTW_PATIENT    },
+  { "exhaustive", FFTW_EXHAUSTIVE },
+  { NULL, 0 }
+};
+
+static dsp_plan findPlan(guint Len, int Sign) {
+  int i;
+  for (i = 0; i < NumPlans; i++)
+    if (Plans[i].Len == Len && Plans[i].Sign == Sign) return Plans[i].Plan;
+  return NULL;
+}
+
+static dsp_plan addPlan(guint Len, int Sign) {
+
+  dsp_plan      Plan;
+  dsp_t        *in;
+  dsp_complex  *tmp;
+
+  if (NumPlans == MAXPLANS) {
+    fprintf(stderr, "addPlan: too many FFT sizes\n");
+    exit(EXIT_FAILURE);
+  }
+
+  // Measuring overwrites the arrays, so plan on scratch ones
+  in  = FFTW(alloc_real)(Len);
+  tmp = FFTW(alloc_complex)(Len);
+  if (in == NULL || tmp == NULL) {
+    perror("addPlan: Unable to allocate memory for FFT");
+    exit(EXIT_FAILURE);
+  }
+
+  // Would we have to measure?
+  if (PlanFlags != FFTW_ESTIMATE) {
+    if (Sign == 0) Plan = FFTW(plan_dft_r2c_1d)(Len, in, tmp, PlanFlags | FFTW_WISDOM_ONLY);
+    else           Plan = FFTW(plan_dft_1d)(Len, tmp, tmp, Sign, PlanFlags | FFTW_WISDOM_ONLY);
+    if (Plan == NULL) {
+      printf("Planning %d-point FFT, this is only done once\n", Len);
+      NewWisdom = TRUE;
+    } else {
+      FFTW(destroy_plan)(Plan);
+    }
+  }
+
+  if (Sign == 0) Plan = FFTW(plan_dft_r2c_1d)(Len, in, tmp, PlanFlags);
+  else           Plan = FFTW(plan_dft_1d)(Len, tmp, tmp, Sign, PlanFlags);
+
+  FFTW(free)(in);
+  FFTW(free)(tmp);
+
+  Plans[NumPlans].Len  = Len;
+  Plans[NumPlans].Sign = Sign;
+  Plans[NumPlans].Plan = Plan;
+  NumPlans ++;
+
+  return Plan;
+}
+
+static dsp_plan lookupPlan(guint Len, int Sign) {
+
+  dsp_plan Plan;
+
+  pthread_mutex_lock(&PlanLock);
+  Plan = findPlan(Len, Sign);
+  if (Plan == NULL) Plan = addPlan(Len, Sign);
+  pthread_mutex_unlock(&PlanLock);
+
+  return Plan;
+}
+
+/* Real-input plan, for FFTW(execute_dft_r2c)() from the in to the out of
+ * any FFTStuff
+ */
+dsp_plan getPlan(guint Len) {
+  return lookupPlan(Len, 0);
+}
+
+/* In-place complex plan, for FFTW(execute_dft)() on any array from
+ * FFTW(alloc_complex)()
+ *  Sign:  FFTW_FORWARD or FFTW_BACKWARD
+ */
+dsp_plan getComplexPlan(guint Len, int Sign) {
+  return lookupPlan(Len, Sign);
+}
+
+// A decoder's own buffers for the real-input plans
+void allocFFTBuffers(FFTStuff *f) {
+
+  f->in  = FFTW(alloc_real)(FFT_MAXLEN);
+  f->out = FFTW(alloc_complex)(FFT_MAXLEN);
+  if (f->in == NULL || f->out == NULL) {
+    perror("allocFFTBuffers: Unable to allocate memory for FFT");
+    exit(EXIT_FAILURE);
+  }
+  memset(f->in, 0, sizeof(dsp_t) * FFT_MAXLEN);
+  f->Used = 0;
+}
+
+void freeFFTBuffers(FFTStuff *f) {
+  FFTW(free)(f->in);
+  FFTW(free)(f->out);
+  f->in  = NULL;
+  f->out = NULL;
+}
+
+/* Load wisdom; before any decoder is made
+ *  planner:  "estimate", "measure" (NULL), "patient" or "exhaustive"
+ */
+void initFFT(char *planner) {
+
+  int i;
+
+  if (planner != NULL) {
+    for (i = 0; Planners[i].Name != NULL; i++)
+      if (strcmp(planner, Planners[i].Name) == 0) break;
+    if (Planners[i].Name != NULL) PlanFlags = Planners[i].Flags;
+    else printf("Unknown FFT planner '%s', using measure\n", planner);
+  }
+
+  // Double and single precision wisdom don't mix
+#ifdef SLOWRX_FLOAT
+  WisdomPath = g_build_filename(g_get_user_config_dir(), "slowrx-wisdomf", NULL);
+#else
+  WisdomPath = g_build_filename(g_get_user_config_dir(), "slowrx-wisdom", NULL);
+#endif
+  FFTW(import_wisdom_from_filename)(WisdomPath);
+}
+
+/* Plan the sizes a decoder uses at its sample rate now rather than in the
+ * middle of a picture; from openPcm()
+ */
+void planSizes(Decoder *d) {
+
+  static dsp_t Window[FFT_MAXLEN];
+  gushort      HannLens[7] = HANN_LENS;
+  guint        FFTLen = scaleFFT(d, 1024);
+  ZoomFFT      z;
+  PulseFilter  p;
+  int          j;
+
+  // VIS and FSK, video
+  getPlan(scaleFFT(d, 2048));
+  getPlan(FFTLen);
+
+  // Zoom FFTs of the video band
+  for (j = 0; j < 7; j++) {
+    if (initZoomFFT(&z, Window, scaleLen(d, HannLens[j]), FFTLen,
+          GetBin(d, 1500, FFTLen) - 1, GetBin(d, 2300, FFTLen) + 1))
+      freeZoomFFT(&z);
+  }
+
+  // Sync pulse filters of every mode
+  for (j = M1; j <= W2180; j++) {
+    initPulse(&p, d, ModeSpec[j].SyncTime, 1200);
+    freePulse(&p);
+  }
+}
+
+// Save any new wisdom and free the plans; after the last decoder is gone
+void freeFFT() {
+
+  int i;
+
+  if (NewWisdom && !FFTW(export_wisdom_to_filename)(WisdomPath))
+    fprintf(stderr, "Unable to save FFTW wisdom to %s\n", WisdomPath);
+
+  for (i = 0; i < NumPlans; i++) FFTW(destroy_plan)(Plans[i].Plan);
+  NumPlans = 0;
+
+  g_free(WisdomPath);
+  WisdomPath = NULL;
+}
@@ -1,7 +1,7 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <gtk/gtk.h>
-#include <alsa/asoundlib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include <fftw3.h>
 
@@ -17,11 +17,13 @@
  *
  */
 
-void GetFSK (char *dest) {
+void GetFSK (Decoder *d, char *dest) {
 
-  guint      FFTLen = 2048, i=0, LoBin, HiBin, MidBin, TestNum=0, TestPtr=0;
+  guint      FFTLen = scaleFFT(d, 2048), i=0, LoBin, HiBin, MidBin, TestNum=0, TestPtr=0;
+  int        BitLen = scaleLen(d, 970), Half = BitLen / 2;
   guchar     Bit = 0, AsciiByte = 0, BytePtr = 0, TestBits[24] = {0}, BitPtr=0;
-  double     HiPow,LoPow,Hann[970];
+  double     HiPow,LoPow;
+  dsp_t      Hann[FFT_MAXLEN], Power[FFT_MAXLEN];
   gboolean   InSync = FALSE;
 
   // Bit-reversion lookup table
@@ -35,39 +37,41 @@ void GetFSK (char *dest) {
     0x03, 0x23, 0x13, 0x33,   0x0b, 0x2b, 0x1b, 0x3b,
     0x07, 0x27, 0x17, 0x37,   0x0f, 0x2f, 0x1f, 0x3f };
 
-  for (i = 0; i < FFTLen; i++) fft.in[i] = 0;
-
   // Create 22ms Hann window
-  for (i = 0; i < 970; i++) Hann[i] = 0.5 * (1 - cos( 2 * M_PI * i / 969.0 ) );
+  for (i = 0; i < (guint)BitLen; i++) Hann[i] = 0.5 * (1 - cos( 2 * M_PI * i / (BitLen - 1.0) ) );
 
   while ( TRUE ) {
 
     // Read data from DSP
-    readPcm(InSync ? 970: 485);
+    readPcm(d, InSync ? BitLen : Half);
+
+    if (d->Abort) break;
 
-    if (pcm.WindowPtr < 485) {
-      pcm.WindowPtr += (InSync ? 970 : 485);
+    if (d->pcm.WindowPtr < Half) {
+      d->pcm.WindowPtr += (InSync ? BitLen : Half);
       continue;
     }
 
     // Apply Hann window
-    for (i = 0; i < 970; i++) fft.in[i] = pcm.Buffer[pcm.WindowPtr+i- 485] * Hann[i];
+    windowFFT(&d->fft, d->pcm.Buffer + d->pcm.WindowPtr - Half, Hann, BitLen);
     
-    pcm.WindowPtr += (InSync ? 970 : 485);
+    d->pcm.WindowPtr += (InSync ? BitLen : Half);
 
     // FFT of last 22 ms
-    fftw_execute(fft.Plan2048);
+    FFTW(execute_dft_r2c)(getPlan(FFTLen), d->fft.in, d->fft.out);
 
-    LoBin  = GetBin(1900+CurrentPic.HedrShift, FFTLen)-1;
-    MidBin = GetBin(2000+CurrentPic.HedrShift, FFTLen);
-    HiBin  = GetBin(2100+CurrentPic.HedrShift, FFTLen)+1;
+    LoBin  = GetBin(d, 1900+d->CurrentPic.HedrShift, FFTLen)-1;
+    MidBin = GetBin(d, 2000+d->CurrentPic.HedrShift, FFTLen);
+    HiBin  = GetBin(d, 2100+d->CurrentPic.HedrShift, FFTLen)+1;
 
     LoPow = 0;
     HiPow = 0;
 
+    powerSpectrum(d->fft.out, Power, LoBin, HiBin);
+
     for (i = LoBin; i <= HiBin; i++) {
-      if (i < MidBin) LoPow += power(fft.out[i]);
-      else            HiPow += power(fft.out[i]);
+      if (i < MidBin) LoPow += Power[i];
+      else            HiPow += Power[i];
     }
 
     Bit = (LoPow>HiPow);
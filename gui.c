@@ -1,74 +1,134 @@
 #include <stdlib.h>
+#include <string.h>
 #include <gtk/gtk.h>
-#include <alsa/asoundlib.h>
+#include <pthread.h>
 #include <math.h>
+#include <time.h>
 
-#include <fftw3.h>
+#include "libslowrx.h"
+#include "gui.h"
 
-#include "common.h"
+GKeyFile    *config          = NULL;
 
-void createGUI() {
+GuiObjs      gui;
+Panel        Panels[MAXPANELS];
+int          NumPanels       = 0;
+
+GtkListStore *savedstore     = NULL;
+
+// Runs Listen() for every panel with a device open
+static GThreadPool *ListenPool = NULL;
+
+// Get a panel's widgets from the builder it was made with, and give it a decoder
+static void buildPanel(Panel *p, GtkBuilder *builder) {
+
+  p->button_abort    = GTK_WIDGET(gtk_builder_get_object(builder,"button_abort"));
+  p->button_clear    = GTK_WIDGET(gtk_builder_get_object(builder,"button_clear"));
+  p->button_start    = GTK_WIDGET(gtk_builder_get_object(builder,"button_start"));
+  p->combo_card      = GTK_WIDGET(gtk_builder_get_object(builder,"combo_card"));
+  p->combo_mode      = GTK_WIDGET(gtk_builder_get_object(builder,"combo_mode"));
+  p->combo_slant     = GTK_WIDGET(gtk_builder_get_object(builder,"combo_slant"));
+  p->eventbox_img    = GTK_WIDGET(gtk_builder_get_object(builder,"eventbox_img"));
+  p->frame_manual    = GTK_WIDGET(gtk_builder_get_object(builder,"frame_manual"));
+  p->frame_slant     = GTK_WIDGET(gtk_builder_get_object(builder,"frame_slant"));
+  p->grid_vu         = GTK_WIDGET(gtk_builder_get_object(builder,"grid_vu"));
+  p->image_devstatus = GTK_WIDGET(gtk_builder_get_object(builder,"image_devstatus"));
+  p->image_pwr       = GTK_WIDGET(gtk_builder_get_object(builder,"image_pwr"));
+  p->image_rx        = GTK_WIDGET(gtk_builder_get_object(builder,"image_rx"));
+  p->image_snr       = GTK_WIDGET(gtk_builder_get_object(builder,"image_snr"));
+  p->label_fskid     = GTK_WIDGET(gtk_builder_get_object(builder,"label_fskid"));
+  p->label_lastmode  = GTK_WIDGET(gtk_builder_get_object(builder,"label_lastmode"));
+  p->label_utc       = GTK_WIDGET(gtk_builder_get_object(builder,"label_utc"));
+  p->spin_shift      = GTK_WIDGET(gtk_builder_get_object(builder,"spin_shift"));
+  p->tog_adapt       = GTK_WIDGET(gtk_builder_get_object(builder,"tog_adapt"));
+  p->tog_fsk         = GTK_WIDGET(gtk_builder_get_object(builder,"tog_fsk"));
+  p->tog_rx          = GTK_WIDGET(gtk_builder_get_object(builder,"tog_rx"));
+  p->tog_save        = GTK_WIDGET(gtk_builder_get_object(builder,"tog_save"));
+  p->tog_setedge     = GTK_WIDGET(gtk_builder_get_object(builder,"tog_setedge"));
+  p->tog_slant       = GTK_WIDGET(gtk_builder_get_object(builder,"tog_slant"));
+
+  g_signal_connect        (p->button_abort,  "clicked",      G_CALLBACK(evt_AbortRx),       p);
+  g_signal_connect        (p->button_clear,  "clicked",      G_CALLBACK(evt_clearPix),      p);
+  g_signal_connect        (p->button_start,  "clicked",      G_CALLBACK(evt_ManualStart),   p);
+  g_signal_connect        (p->combo_card,    "changed",      G_CALLBACK(evt_changeDevices), p);
+  g_signal_connect        (p->eventbox_img,  "button-press-event",G_CALLBACK(evt_clickimg),     p);
+  g_signal_connect        (p->eventbox_img,  "motion-notify-event",G_CALLBACK(evt_dragimg),     p);
+  g_signal_connect        (p->eventbox_img,  "button-release-event",G_CALLBACK(evt_releaseimg), p);
+  g_signal_connect        (p->tog_adapt,     "toggled",      G_CALLBACK(evt_GetAdaptive),   p);
+
+  p->dec = newDecoder(&GuiCallbacks, p);
+  gtk_combo_box_set_active(GTK_COMBO_BOX(p->combo_slant), getOptions(p->dec)->SlantMethod);
+  g_signal_connect        (p->combo_slant,   "changed",      G_CALLBACK(evt_GetSlantMethod), p);
+  g_mutex_init(&p->Lock);
+  g_cond_init (&p->Stopped);
+
+  p->pixbuf_disp = gdk_pixbuf_scale_simple (getPic(p->dec)->pixbuf, 500, 400, GDK_INTERP_BILINEAR);
+  gtk_image_set_from_pixbuf(GTK_IMAGE(p->image_rx), p->pixbuf_disp);
+
+  p->pixbuf_PWR = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 100, 30);
+  p->pixbuf_SNR = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 100, 30);
+
+  gtk_combo_box_set_active(GTK_COMBO_BOX(p->combo_mode), 0);
+}
+
+/* Make the main window with numpanels receivers. The first one is the Rx
+ * page of slowrx.ui; the others are built from another copy of that page
+ */
+void createGUI(int numpanels) {
 
   GtkBuilder *builder;
+  GtkWidget  *page;
+  Panel      *p;
+  int         i;
+  gchar      *pageobjs[] = { "alignment2", "adjust_shift", "action1", NULL };
 
   builder = gtk_builder_new();
   gtk_builder_add_from_file(builder, "slowrx.ui",      NULL);
   gtk_builder_add_from_file(builder, "aboutdialog.ui", NULL);
   
-  gui.button_abort    = GTK_WIDGET(gtk_builder_get_object(builder,"button_abort"));
   gui.button_browse   = GTK_WIDGET(gtk_builder_get_object(builder,"button_browse"));
-  gui.button_clear    = GTK_WIDGET(gtk_builder_get_object(builder,"button_clear"));
-  gui.button_start    = GTK_WIDGET(gtk_builder_get_object(builder,"button_start"));
-  gui.combo_card      = GTK_WIDGET(gtk_builder_get_object(builder,"combo_card"));
-  gui.combo_mode      = GTK_WIDGET(gtk_builder_get_object(builder,"combo_mode"));
   gui.entry_picdir    = GTK_WIDGET(gtk_builder_get_object(builder,"entry_picdir"));
-  gui.eventbox_img    = GTK_WIDGET(gtk_builder_get_object(builder,"eventbox_img"));
-  gui.frame_manual    = GTK_WIDGET(gtk_builder_get_object(builder,"frame_manual"));
-  gui.frame_slant     = GTK_WIDGET(gtk_builder_get_object(builder,"frame_slant"));
-  gui.grid_vu         = GTK_WIDGET(gtk_builder_get_object(builder,"grid_vu"));
   gui.iconview        = GTK_WIDGET(gtk_builder_get_object(builder,"SavedIconView"));
-  gui.image_devstatus = GTK_WIDGET(gtk_builder_get_object(builder,"image_devstatus"));
-  gui.image_pwr       = GTK_WIDGET(gtk_builder_get_object(builder,"image_pwr"));
-  gui.image_rx        = GTK_WIDGET(gtk_builder_get_object(builder,"image_rx"));
-  gui.image_snr       = GTK_WIDGET(gtk_builder_get_object(builder,"image_snr"));
-  gui.label_fskid     = GTK_WIDGET(gtk_builder_get_object(builder,"label_fskid"));
-  gui.label_lastmode  = GTK_WIDGET(gtk_builder_get_object(builder,"label_lastmode"));
-  gui.label_utc       = GTK_WIDGET(gtk_builder_get_object(builder,"label_utc"));
   gui.menuitem_quit   = GTK_WIDGET(gtk_builder_get_object(builder,"menuitem_quit"));
   gui.menuitem_about  = GTK_WIDGET(gtk_builder_get_object(builder,"menuitem_about"));
-  gui.spin_shift      = GTK_WIDGET(gtk_builder_get_object(builder,"spin_shift"));
+  gui.notebook        = GTK_WIDGET(gtk_builder_get_object(builder,"notebook1"));
   gui.statusbar       = GTK_WIDGET(gtk_builder_get_object(builder,"statusbar"));
-  gui.tog_adapt       = GTK_WIDGET(gtk_builder_get_object(builder,"tog_adapt"));
-  gui.tog_fsk         = GTK_WIDGET(gtk_builder_get_object(builder,"tog_fsk"));
-  gui.tog_rx          = GTK_WIDGET(gtk_builder_get_object(builder,"tog_rx"));
-  gui.tog_save        = GTK_WIDGET(gtk_builder_get_object(builder,"tog_save"));
-  gui.tog_setedge     = GTK_WIDGET(gtk_builder_get_object(builder,"tog_setedge"));
-  gui.tog_slant       = GTK_WIDGET(gtk_builder_get_object(builder,"tog_slant"));
   gui.window_about    = GTK_WIDGET(gtk_builder_get_object(builder,"window_about"));
   gui.window_main     = GTK_WIDGET(gtk_builder_get_object(builder,"window_main"));
 
-  g_signal_connect        (gui.button_abort,  "clicked",      G_CALLBACK(evt_AbortRx),       NULL);
   g_signal_connect        (gui.button_browse, "clicked",      G_CALLBACK(evt_chooseDir),     NULL);
-  g_signal_connect        (gui.button_clear,  "clicked",      G_CALLBACK(evt_clearPix),      NULL);
-  g_signal_connect        (gui.button_start,  "clicked",      G_CALLBACK(evt_ManualStart),   NULL);
-  g_signal_connect        (gui.combo_card,    "changed",      G_CALLBACK(evt_changeDevices), NULL);
-  g_signal_connect        (gui.eventbox_img,  "button-press-event",G_CALLBACK(evt_clickimg),     NULL);
   g_signal_connect        (gui.menuitem_quit, "activate",     G_CALLBACK(evt_deletewindow),  NULL);
   g_signal_connect        (gui.menuitem_about,"activate",     G_CALLBACK(evt_show_about),    NULL);
-  g_signal_connect_swapped(gui.tog_adapt,     "toggled",      G_CALLBACK(evt_GetAdaptive),   NULL);
   g_signal_connect        (gui.window_main,   "delete-event", G_CALLBACK(evt_deletewindow),  NULL);
 
   savedstore = GTK_LIST_STORE(gtk_icon_view_get_model(GTK_ICON_VIEW(gui.iconview)));
 
-  pixbuf_rx   = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 320, 256);
-  gdk_pixbuf_fill(pixbuf_rx, 0x000000ff);
-  pixbuf_disp = gdk_pixbuf_scale_simple (pixbuf_rx, 500, 400, GDK_INTERP_BILINEAR);
-  gtk_image_set_from_pixbuf(GTK_IMAGE(gui.image_rx), pixbuf_disp);
+  NumPanels = CLAMP(numpanels, 1, MAXPANELS);
+  for (i=0; i<NumPanels; i++) {
+    p = &Panels[i];
+    p->Index = i;
+    if (NumPanels == 1) snprintf(p->Name, sizeof(p->Name), "Rx");
+    else                snprintf(p->Name, sizeof(p->Name), "Rx %d", i+1);
+
+    if (i == 0) {
+      buildPanel(p, builder);
+      page = GTK_WIDGET(gtk_builder_get_object(builder,"alignment2"));
+      gtk_notebook_set_tab_label_text(GTK_NOTEBOOK(gui.notebook), page, p->Name);
+    } else {
+      builder = gtk_builder_new();
+      gtk_builder_add_objects_from_file(builder, "slowrx.ui", pageobjs, NULL);
+      buildPanel(p, builder);
+      page = GTK_WIDGET(gtk_builder_get_object(builder,"alignment2"));
+      gtk_notebook_insert_page(GTK_NOTEBOOK(gui.notebook), page, gtk_label_new(p->Name), i);
 
-  pixbuf_PWR = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 100, 30);
-  pixbuf_SNR = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, 100, 30);
+      // There's one picture directory for all
+      gtk_widget_set_no_show_all(GTK_WIDGET(gtk_builder_get_object(builder,"picdir_frame")), TRUE);
+      gtk_widget_hide           (GTK_WIDGET(gtk_builder_get_object(builder,"picdir_frame")));
+    }
+  }
 
-  gtk_combo_box_set_active(GTK_COMBO_BOX(gui.combo_mode), 0);
+  // A listener per panel: they spend their time waiting for audio, so none can wait for a thread
+  ListenPool = g_thread_pool_new(Listen, NULL, NumPanels, FALSE, NULL);
 
   if (g_key_file_get_string(config,"slowrx","rxdir",NULL) != NULL) {
     gtk_entry_set_text(GTK_ENTRY(gui.entry_picdir),g_key_file_get_string(config,"slowrx","rxdir",NULL));
@@ -83,18 +143,37 @@ void createGUI() {
 
 }
 
+// Stop all listeners and free the panels' decoders
+void freeGUI() {
+  int i;
+
+  for (i=0; i<NumPanels; i++) stopListening(&Panels[i]);
+  g_thread_pool_free(ListenPool, FALSE, TRUE);
+
+  for (i=0; i<NumPanels; i++) freeDecoder(Panels[i].dec);
+}
+
+// Config key of a panel's setting: "device" for the first, "device2" for the second etc.
+void configKey(Panel *p, char *key, char *dest, int len) {
+  if (p->Index == 0) snprintf(dest, len, "%s", key);
+  else               snprintf(dest, len, "%s%d", key, p->Index + 1);
+}
+
 // Draw signal level meters according to given values
-void setVU (double *Power, int FFTLen, int WinIdx, gboolean ShowWin) {
+static void rxVU (Decoder *d, dsp_t *Power, int FFTLen, int WinIdx, gboolean ShowWin) {
   int          x,y, W=100, H=30;
   guchar       *pixelsPWR, *pixelsSNR, *pPWR, *pSNR;
   unsigned int rowstridePWR,rowstrideSNR, LoBin, HiBin, i;
-  double       logpow,p;
+  double       logpow,level;
+  Panel        *p = getUser(d);
 
-  rowstridePWR = gdk_pixbuf_get_rowstride (pixbuf_PWR);
-  pixelsPWR    = gdk_pixbuf_get_pixels    (pixbuf_PWR);
+  (void)ShowWin;
+
+  rowstridePWR = gdk_pixbuf_get_rowstride (p->pixbuf_PWR);
+  pixelsPWR    = gdk_pixbuf_get_pixels    (p->pixbuf_PWR);
   
-  rowstrideSNR = gdk_pixbuf_get_rowstride (pixbuf_SNR);
-  pixelsSNR    = gdk_pixbuf_get_pixels    (pixbuf_SNR);
+  rowstrideSNR = gdk_pixbuf_get_rowstride (p->pixbuf_SNR);
+  pixelsSNR    = gdk_pixbuf_get_pixels    (p->pixbuf_SNR);
 
   for (y=0; y<H; y++) {
     for (x=0; x<W; x++) {
@@ -120,17 +199,17 @@ void setVU (double *Power, int FFTLen, int WinIdx, gboolean ShowWin) {
         }
       }
 
-      LoBin = (int)((W-1-x)*(6000/W)/44100.0 * FFTLen);
-      HiBin = (int)((W  -x)*(6000/W)/44100.0 * FFTLen);
+      LoBin = MIN((int)((W-1-x)*(6000/W)/getSampleRate(d) * FFTLen), FFTLen/2);
+      HiBin = MIN((int)((W  -x)*(6000/W)/getSampleRate(d) * FFTLen), FFTLen/2);
 
       logpow = 0;
       for (i=LoBin; i<HiBin; i++) logpow += log(850*Power[i]) / 2;
 
-      p = (H-1-y)/(H/23.0);
+      level = (H-1-y)/(H/23.0);
 
       pPWR[0] = pPWR[1] = pPWR[2] = 0;
 
-      if (logpow > p) {
+      if (logpow > level) {
         pPWR[0] = 0;//clip(pPWR[0] + 0x22 * (logpow-p) / (HiBin-LoBin+1));
         pPWR[1] = 192;//clip(pPWR[1] + 0x66 * (logpow-p) / (HiBin-LoBin+1));
         pPWR[2] = 64;//clip(pPWR[2] + 0x22 * (logpow-p) / (HiBin-LoBin+1));
@@ -147,8 +226,8 @@ void setVU (double *Power, int FFTLen, int WinIdx, gboolean ShowWin) {
   }
 
   gdk_threads_enter();
-  gtk_image_set_from_pixbuf(GTK_IMAGE(gui.image_pwr), pixbuf_PWR);
-  gtk_image_set_from_pixbuf(GTK_IMAGE(gui.image_snr), pixbuf_SNR);
+  gtk_image_set_from_pixbuf(GTK_IMAGE(p->image_pwr), p->pixbuf_PWR);
+  gtk_image_set_from_pixbuf(GTK_IMAGE(p->image_snr), p->pixbuf_SNR);
   gdk_threads_leave();
 
 }
@@ -174,3 +253,354 @@ void evt_show_about() {
   gtk_dialog_run(GTK_DIALOG(gui.window_about));
   gtk_widget_hide(gui.window_about);
 }
+
+/*** Decoder callbacks ***/
+
+
+// Show a message in the status bar, saying which receiver it's from if there are several
+static void rxStatus(Decoder *d, char *text) {
+  Panel *p = getUser(d);
+  gchar *msg = (NumPanels > 1 ? g_strdup_printf("%s: %s", p->Name, text) : g_strdup(text));
+
+  gdk_threads_enter();
+  gtk_statusbar_push( GTK_STATUSBAR(gui.statusbar), 0, msg );
+  gdk_threads_leave();
+  g_free(msg);
+}
+
+// Reflect a received VIS header in the manual start controls; receive it if rx is enabled
+static gboolean rxVIS(Decoder *d, guchar Mode, gshort HedrShift) {
+  Panel *p = getUser(d);
+  gdk_threads_enter();
+  gtk_combo_box_set_active (GTK_COMBO_BOX(p->combo_mode), Mode-1);
+  gtk_spin_button_set_value (GTK_SPIN_BUTTON(p->spin_shift), HedrShift);
+  gdk_threads_leave();
+
+  return gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(p->tog_rx));
+}
+
+// Reception begins
+static void rxStart(Decoder *d) {
+  Panel     *p   = getUser(d);
+  PicMeta   *Pic = getPic(d);
+  char       rctime[8];
+  time_t     timet;
+  struct tm  tm;
+
+  getOptions(d)->FSK       = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(p->tog_fsk));
+  getOptions(d)->AutoSlant = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(p->tog_slant));
+
+  timet = time(NULL);
+  gmtime_r(&timet, &tm);
+  strftime(rctime, sizeof(rctime)-1, "%H:%Mz", &tm);
+
+  gdk_threads_enter        ();
+  gtk_label_set_text       (GTK_LABEL(p->label_fskid), "");
+  gtk_widget_set_sensitive (p->frame_manual, FALSE);
+  gtk_widget_set_sensitive (p->frame_slant,  FALSE);
+  gtk_widget_set_sensitive (p->combo_card,   FALSE);
+  gtk_widget_set_sensitive (p->button_abort, TRUE);
+  gtk_widget_set_sensitive (p->button_clear, FALSE);
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(p->tog_setedge), FALSE);
+  gtk_label_set_markup     (GTK_LABEL(p->label_lastmode), ModeSpec[Pic->Mode].Name);
+  gtk_label_set_markup     (GTK_LABEL(p->label_utc), rctime);
+  gdk_threads_leave        ();
+
+  rxStatus(d, "Receiving video...");
+}
+
+// Scale the received picture to the display
+static void rxLine(Decoder *d, int y) {
+  Panel   *p   = getUser(d);
+  PicMeta *Pic = getPic(d);
+
+  (void)y;
+
+  g_object_unref(p->pixbuf_disp);
+  p->pixbuf_disp = gdk_pixbuf_scale_simple(Pic->pixbuf, 500,
+      500.0/ModeSpec[Pic->Mode].ImgWidth * ModeSpec[Pic->Mode].NumLines * ModeSpec[Pic->Mode].LineHeight, GDK_INTERP_BILINEAR);
+
+  gdk_threads_enter();
+  gtk_image_set_from_pixbuf(GTK_IMAGE(p->image_rx), p->pixbuf_disp);
+  gdk_threads_leave();
+}
+
+static void rxFSKID(Decoder *d, char *id) {
+  Panel *p = getUser(d);
+  gdk_threads_enter  ();
+  gtk_label_set_text (GTK_LABEL(p->label_fskid), id);
+  gdk_threads_leave  ();
+}
+
+// Picture done: add a thumbnail and save it
+static void rxImage(Decoder *d, gboolean Finished) {
+  Panel       *p   = getUser(d);
+  PicMeta     *Pic = getPic(d);
+  GtkTreeIter  iter;
+  gchar       *label;
+
+  (void)Finished;
+
+  // A resynced picture is already in the iconview
+  if (p->Resyncing) {
+    p->Resyncing = FALSE;
+    if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(p->tog_save)))
+      savePic(d, g_key_file_get_string(config,"slowrx","rxdir",NULL));
+    return;
+  }
+
+  gdk_threads_enter        ();
+  gtk_widget_set_sensitive (p->button_abort, FALSE);
+  gdk_threads_leave        ();
+
+  // Add thumbnail to iconview
+  Pic->thumbbuf = gdk_pixbuf_scale_simple (Pic->pixbuf, 100,
+      100.0/ModeSpec[Pic->Mode].ImgWidth * ModeSpec[Pic->Mode].NumLines * ModeSpec[Pic->Mode].LineHeight, GDK_INTERP_HYPER);
+  label = (NumPanels > 1 ? g_strdup_printf("%s %s", p->Name, Pic->fskid) : g_strdup(Pic->fskid));
+  gdk_threads_enter                  ();
+  gtk_list_store_prepend             (savedstore, &iter);
+  gtk_list_store_set                 (savedstore, &iter, 0, Pic->thumbbuf, 1, label, -1);
+  gdk_threads_leave                  ();
+  g_free(label);
+
+  // Save PNG
+  if (gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(p->tog_save)))
+    savePic(d, g_key_file_get_string(config,"slowrx","rxdir",NULL));
+
+  gdk_threads_enter        ();
+  gtk_widget_set_sensitive (p->frame_slant,  TRUE);
+  gtk_widget_set_sensitive (p->frame_manual, TRUE);
+  gtk_widget_set_sensitive (p->combo_card,   TRUE);
+  gdk_threads_leave        ();
+}
+
+DecoderCallbacks GuiCallbacks = {
+  .VIS    = rxVIS,
+  .Start  = rxStart,
+  .Line   = rxLine,
+  .FSKID  = rxFSKID,
+  .Image  = rxImage,
+  .Status = rxStatus,
+  .VU     = rxVU
+};
+
+/* Stop the panel's listener, if there is one. A listener that was queued
+ * but hasn't started yet would clear the abort flag, so keep setting it
+ */
+void stopListening(Panel *p) {
+  g_mutex_lock(&p->Lock);
+  p->Stopping = TRUE;
+  while (p->Listening) {
+    abortPic(p->dec);
+    g_cond_wait_until(&p->Stopped, &p->Lock, g_get_monotonic_time() + 10 * G_TIME_SPAN_MILLISECOND);
+  }
+  p->Stopping = FALSE;
+  g_mutex_unlock(&p->Lock);
+}
+
+
+/*** Gtk+ event handlers ***/
+
+
+// Quit
+void evt_deletewindow() {
+  gtk_main_quit ();
+}
+
+// Transform the NoiseAdapt toggle state into a variable
+void evt_GetAdaptive(GtkWidget *widget, Panel *p) {
+  (void)widget;
+  getOptions(p->dec)->Adaptive = gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(p->tog_adapt));
+}
+
+// Slant estimator chosen; kept as slant= in slowrx.ini
+void evt_GetSlantMethod(GtkWidget *widget, Panel *p) {
+  int Method = gtk_combo_box_get_active (GTK_COMBO_BOX(widget));
+
+  if (Method < 0) return;
+  getOptions(p->dec)->SlantMethod = Method;
+  g_key_file_set_string(config, "slowrx", "slant", SlantNames[Method]);
+}
+
+// Manual Start clicked
+void evt_ManualStart(GtkWidget *widget, Panel *p) {
+  (void)widget;
+  gtk_widget_set_sensitive( p->frame_manual, FALSE );
+  gtk_widget_set_sensitive( p->combo_card,   FALSE );
+
+  startManual(p->dec, gtk_combo_box_get_active (GTK_COMBO_BOX(p->combo_mode)) + 1,
+      gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON(p->spin_shift)));
+}
+
+// Abort clicked during rx
+void evt_AbortRx(GtkWidget *widget, Panel *p) {
+  (void)widget;
+  abortPic(p->dec);
+}
+
+// Another device selected from list
+void evt_changeDevices(GtkWidget *widget, Panel *p) {
+
+  int    status;
+  gchar *devname;
+  char   key[20];
+
+  (void)widget;
+
+  stopListening(p);
+  closePcm(p->dec);
+
+  devname = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(p->combo_card));
+  if (strcmp(devname, "stdin") == 0)
+    status = initPcmFile(p->dec, "-", NULL, 44100);
+  else
+    status = initPcmDevice(p, devname);
+
+
+  switch(status) {
+    case 0:
+      gtk_image_set_from_stock(GTK_IMAGE(p->image_devstatus),GTK_STOCK_YES,GTK_ICON_SIZE_SMALL_TOOLBAR);
+      gtk_widget_set_tooltip_text(p->image_devstatus, "Device successfully opened");
+      break;
+    case -1:
+      gtk_image_set_from_stock(GTK_IMAGE(p->image_devstatus),GTK_STOCK_DIALOG_WARNING,GTK_ICON_SIZE_SMALL_TOOLBAR);
+      gtk_widget_set_tooltip_text(p->image_devstatus, "Device was opened, but its sample rate is too low");
+      break;
+    case -2:
+      gtk_image_set_from_stock(GTK_IMAGE(p->image_devstatus),GTK_STOCK_DIALOG_ERROR,GTK_ICON_SIZE_SMALL_TOOLBAR);
+      gtk_widget_set_tooltip_text(p->image_devstatus, "Failed to open device");
+      break;
+  }
+
+  configKey(p, "device", key, sizeof(key));
+  g_key_file_set_string(config,"slowrx",key,devname);
+  g_free(devname);
+
+  p->Listening = TRUE;
+  g_thread_pool_push(ListenPool, p, NULL);
+
+}
+
+// Clear received picture & metadata
+void evt_clearPix(GtkWidget *widget, Panel *p) {
+  (void)widget;
+  gdk_pixbuf_fill (p->pixbuf_disp, 0);
+  gtk_image_set_from_pixbuf(GTK_IMAGE(p->image_rx), p->pixbuf_disp);
+  gtk_label_set_markup (GTK_LABEL(p->label_fskid), "");
+  gtk_label_set_markup (GTK_LABEL(p->label_utc), "");
+  gtk_label_set_markup (GTK_LABEL(p->label_lastmode), "");
+}
+
+/* Rate and skip that put the left edge of the picture through (x0,y0) and
+ * (x1,y1), in pixels and lines
+ *   returns  FALSE if that's not a sensible correction
+ */
+static gboolean edgeSlant(Panel *p, double x0, double y0, double x1, double y1, double *Rate, int *Skip) {
+  PicMeta *Pic = getPic(p->dec);
+  double   dx = x1 - x0, dy = y1 - y0, xic;
+
+  if (fabs(dy) < 1) return FALSE;
+
+  // Adjust sample rate, if in sensible limits
+  *Rate = Pic->Rate + Pic->Rate * (dx * ModeSpec[Pic->Mode].PixelTime) / (dy * ModeSpec[Pic->Mode].LineHeight * ModeSpec[Pic->Mode].LineTime);
+  if (*Rate < getSampleRate(p->dec) * 0.73 || *Rate > getSampleRate(p->dec) * 1.27) return FALSE;
+
+  // Find x-intercept and adjust skip
+  xic = (dx == 0 ? x1 : x1 - (y1 / (dy/dx)));
+  xic = fmod(xic, ModeSpec[Pic->Mode].ImgWidth);
+  if (xic < 0) xic = ModeSpec[Pic->Mode].ImgWidth + xic;
+  *Skip = fmod(Pic->Skip + xic * ModeSpec[Pic->Mode].PixelTime * *Rate,
+    ModeSpec[Pic->Mode].LineTime * *Rate);
+  if (*Skip > ModeSpec[Pic->Mode].LineTime * *Rate / 2.0)
+    *Skip -= ModeSpec[Pic->Mode].LineTime * *Rate;
+
+  return TRUE;
+}
+
+// Pointer position on the picture in pixels and lines
+static void imgPoint(Panel *p, double ex, double ey, double *x, double *y) {
+  PicMeta *Pic = getPic(p->dec);
+  *x = ex * (ModeSpec[Pic->Mode].ImgWidth / 500.0);
+  *y = ey * (ModeSpec[Pic->Mode].ImgWidth / 500.0) / ModeSpec[Pic->Mode].LineHeight;
+}
+
+// Show the picture straightened by an edge through (x,y), at the size it's shown
+static void previewEdge(Panel *p, double x, double y) {
+  PicMeta *Pic = getPic(p->dec);
+  double   Rate = Pic->Rate;
+  int      Skip = Pic->Skip;
+
+  if (!edgeSlant(p, p->EdgeX, p->EdgeY, x, y, &Rate, &Skip)) {
+    Rate = Pic->Rate;
+    Skip = Pic->Skip;
+  }
+  if (previewPic(p->dec, Rate, Skip, p->pixbuf_disp))
+    gtk_image_set_from_pixbuf(GTK_IMAGE(p->image_rx), p->pixbuf_disp);
+}
+
+// Second point of the edge: redraw the whole picture through it
+static void finishEdge(Panel *p, double x, double y) {
+  double Rate;
+  int    Skip;
+
+  p->EdgePicked = p->Dragging = FALSE;
+  gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(p->tog_setedge), FALSE);
+
+  if (edgeSlant(p, p->EdgeX, p->EdgeY, x, y, &Rate, &Skip)) {
+    // Signal the listener to exit from GetVIS() and re-process the pic
+    p->Resyncing = TRUE;
+    resyncPic(p->dec, Rate, Skip);
+  } else {
+    previewEdge(p, p->EdgeX, p->EdgeY);
+  }
+}
+
+/* Manual slant adjust: press on the left edge and drag along it, watching
+ * the picture straighten, or click on two points of it
+ */
+void evt_clickimg(GtkWidget *widget, GdkEventButton* event, Panel *p) {
+  double x, y;
+
+  (void)widget;
+
+  if (event->type == GDK_BUTTON_PRESS && event->button == 1 && gtk_toggle_button_get_active (GTK_TOGGLE_BUTTON(p->tog_setedge))) {
+
+    imgPoint(p, event->x, event->y, &x, &y);
+
+    if (p->EdgePicked) {
+      finishEdge(p, x, y);
+    } else {
+      p->EdgePicked = p->Dragging = TRUE;
+      p->EdgeX = x;
+      p->EdgeY = y;
+    }
+
+  } else {
+    p->EdgePicked = p->Dragging = FALSE;
+    gtk_toggle_button_set_active (GTK_TOGGLE_BUTTON(p->tog_setedge), FALSE);
+  }
+}
+
+void evt_dragimg(GtkWidget *widget, GdkEventMotion* event, Panel *p) {
+  double x, y;
+
+  (void)widget;
+
+  if (!p->Dragging) return;
+
+  imgPoint(p, event->x, event->y, &x, &y);
+  previewEdge(p, x, y);
+}
+
+// A drag ends the edge where it's let go; a click waits for the second one
+void evt_releaseimg(GtkWidget *widget, GdkEventButton* event, Panel *p) {
+  double x, y;
+
+  (void)widget;
+
+  if (!p->Dragging || event->button != 1) return;
+  p->Dragging = FALSE;
+
+  imgPoint(p, event->x, event->y, &x, &y);
+  if (fabs(y - p->EdgeY) >= 2) finishEdge(p, x, y);
+}
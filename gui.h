@@ -0,0 +1,96 @@
+#ifndef _GUI_H_
+#define _GUI_H_
+
+// Most receivers shown at once, one notebook page each
+#define MAXPANELS 8
+
+extern GKeyFile  *config;
+
+extern DecoderCallbacks GuiCallbacks;
+
+typedef struct _GuiObjs GuiObjs;
+struct _GuiObjs {
+  GtkWidget *button_browse;
+  GtkWidget *entry_picdir;
+  GtkWidget *iconview;
+  GtkWidget *menuitem_about;
+  GtkWidget *menuitem_quit;
+  GtkWidget *notebook;
+  GtkWidget *statusbar;
+  GtkWidget *window_about;
+  GtkWidget *window_main;
+};
+extern GuiObjs   gui;
+
+// One receiver: a capture stream, its decoder and its page of widgets
+typedef struct _Panel Panel;
+struct _Panel {
+  int        Index;
+  char       Name[16];            // notebook tab, also prefixes status messages
+  Decoder   *dec;
+
+  GtkWidget *button_abort;
+  GtkWidget *button_clear;
+  GtkWidget *button_start;
+  GtkWidget *combo_card;
+  GtkWidget *combo_mode;
+  GtkWidget *combo_slant;
+  GtkWidget *eventbox_img;
+  GtkWidget *frame_manual;
+  GtkWidget *frame_slant;
+  GtkWidget *grid_vu;
+  GtkWidget *image_devstatus;
+  GtkWidget *image_pwr;
+  GtkWidget *image_rx;
+  GtkWidget *image_snr;
+  GtkWidget *label_fskid;
+  GtkWidget *label_lastmode;
+  GtkWidget *label_utc;
+  GtkWidget *spin_shift;
+  GtkWidget *tog_adapt;
+  GtkWidget *tog_fsk;
+  GtkWidget *tog_rx;
+  GtkWidget *tog_save;
+  GtkWidget *tog_setedge;
+  GtkWidget *tog_slant;
+
+  GdkPixbuf *pixbuf_disp;
+  GdkPixbuf *pixbuf_PWR;
+  GdkPixbuf *pixbuf_SNR;
+
+  gboolean   Resyncing;           // the picture being redrawn was resynced by hand
+  gboolean   EdgePicked;          // first point of the left edge is in EdgeX, EdgeY
+  gboolean   Dragging;            // and the button is still down
+  double     EdgeX, EdgeY;        // in pixels and lines of the picture
+  gboolean   Listening;           // Listen() is queued or running for this panel
+  volatile gboolean Stopping;     // stopListening() is waiting for it
+  GMutex     Lock;
+  GCond      Stopped;
+};
+extern Panel     Panels[MAXPANELS];
+extern int       NumPanels;
+
+extern GtkListStore *savedstore;
+
+void     createGUI     (int numpanels);
+void     freeGUI       ();
+void     configKey     (Panel *p, char *key, char *dest, int len);
+int      initPcmDevice (Panel *p, char *wanteddevname);
+void     Listen        (gpointer data, gpointer pooldata);
+void     populateDeviceList (Panel *p);
+void     stopListening (Panel *p);
+
+void     evt_AbortRx       (GtkWidget *widget, Panel *p);
+void     evt_changeDevices (GtkWidget *widget, Panel *p);
+void     evt_chooseDir     ();
+void     evt_clearPix      (GtkWidget *widget, Panel *p);
+void     evt_clickimg      (GtkWidget *widget, GdkEventButton* event, Panel *p);
+void     evt_dragimg       (GtkWidget *widget, GdkEventMotion* event, Panel *p);
+void     evt_releaseimg    (GtkWidget *widget, GdkEventButton* event, Panel *p);
+void     evt_deletewindow  ();
+void     evt_GetAdaptive   (GtkWidget *widget, Panel *p);
+void     evt_GetSlantMethod(GtkWidget *widget, Panel *p);
+void     evt_ManualStart   (GtkWidget *widget, Panel *p);
+void     evt_show_about    ();
+
+#endif
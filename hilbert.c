@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Quadrature FM demodulator
+ *
+ * A complex FIR (Hamming-windowed low-pass shifted up to the middle of the
+ * video band) passes 900..2900 Hz and throws away negative frequencies, so
+ * its output z[n] is the analytic signal. The instantaneous frequency is the
+ * phase step arg(z[n] conj(z[n-1])); summing those products over AvgLen
+ * samples around the window center before taking the angle averages out noise
+ * the way a longer FFT window would, weighted by signal amplitude.
+ *
+ * The filter runs HILBERT_LEAD samples ahead of the center so that the
+ * averaging length can change on the fly without refiltering anything.
+ *
+ */
+
+#define HILBERT_MASK (HILBERT_HIST - 1)
+
+// Analytic signal at *x
+static void analytic(HilbertDemod *h, gint16 *x, double *re, double *im) {
+
+  int    i;
+  double r = 0, q = 0;
+
+  for (i = 0; i < HILBERT_TAPS; i++) {
+    r += x[HILBERT_TAPS/2 - i] * h->TapRe[i];
+    q += x[HILBERT_TAPS/2 - i] * h->TapIm[i];
+  }
+
+  *re = r / 32768.0;
+  *im = q / 32768.0;
+}
+
+// Filter sample n (counted from the first call) and store its phase step
+static void push(HilbertDemod *h, gint16 *x, guint n) {
+
+  guint  i = n & HILBERT_MASK, p = (n-1) & HILBERT_MASK;
+
+  analytic(h, x, &h->ZRe[i], &h->ZIm[i]);
+  h->DRe[i] = h->ZRe[i] * h->ZRe[p] + h->ZIm[i] * h->ZIm[p];
+  h->DIm[i] = h->ZIm[i] * h->ZRe[p] - h->ZRe[i] * h->ZIm[p];
+}
+
+// Design the filter for Rate around CenterFreq and forget all history
+void initHilbert(HilbertDemod *h, double Rate, double CenterFreq) {
+
+  int    i, k;
+  double lp, w0 = 2 * M_PI * CenterFreq / Rate, fc = 1000.0 / Rate;
+
+  h->Rate = Rate;
+
+  for (i = 0; i < HILBERT_TAPS; i++) {
+    k  = i - HILBERT_TAPS/2;
+    lp = (k == 0 ? 2 * fc : sin(2 * M_PI * fc * k) / (M_PI * k)) *
+         (0.54 - 0.46 * cos(2 * M_PI * i / (HILBERT_TAPS - 1)));
+    h->TapRe[i] = lp * cos(w0 * k);
+    h->TapIm[i] = lp * sin(w0 * k);
+  }
+
+  memset(h->ZRe, 0, sizeof(h->ZRe));
+  memset(h->ZIm, 0, sizeof(h->ZIm));
+
+  h->Count  = 0;
+  h->AvgLen = 0;
+}
+
+/* Frequency at *center in Hz, averaged over AvgLen samples
+ * Must be called for every sample in order.
+ */
+double hilbertFreq(HilbertDemod *h, gint16 *center, int AvgLen) {
+
+  int   d;
+  guint n;
+
+  if (AvgLen < 2)                AvgLen = 2;
+  if (AvgLen > 2*HILBERT_LEAD)   AvgLen = 2*HILBERT_LEAD;
+
+  if (h->AvgLen == 0) {
+    // First sample: fill in the history up to the lead
+    for (d = -HILBERT_LEAD; d <= HILBERT_LEAD; d++)
+      push(h, center + d, h->Count + d);
+  } else {
+    h->Count ++;
+    push(h, center + HILBERT_LEAD, h->Count + HILBERT_LEAD);
+  }
+
+  n = h->Count;
+
+  if (AvgLen != h->AvgLen || h->Age > 65536) {
+    // Sum directly on length change, and now and then to shed rounding errors
+    h->SumRe = h->SumIm = 0;
+    for (d = -AvgLen/2 + 1; d <= AvgLen/2; d++) {
+      h->SumRe += h->DRe[(n + d) & HILBERT_MASK];
+      h->SumIm += h->DIm[(n + d) & HILBERT_MASK];
+    }
+    h->AvgLen = AvgLen;
+    h->Age    = 0;
+  } else {
+    h->SumRe += h->DRe[(n + AvgLen/2) & HILBERT_MASK] - h->DRe[(n - AvgLen/2) & HILBERT_MASK];
+    h->SumIm += h->DIm[(n + AvgLen/2) & HILBERT_MASK] - h->DIm[(n - AvgLen/2) & HILBERT_MASK];
+    h->Age ++;
+  }
+
+  return atan2(h->SumIm, h->SumRe) * h->Rate / (2 * M_PI);
+}
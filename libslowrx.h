@@ -0,0 +1,171 @@
+#ifndef _LIBSLOWRX_H_
+#define _LIBSLOWRX_H_
+
+/*
+ * libslowrx - SSTV decoder library
+ * * * * * * * * * * * * * * * * * *
+ *
+ * Everything a decoder knows lives in a Decoder made by newDecoder(), so any
+ * number of them can run in one process, each on its own thread. Samples
+ * come from a PcmSource; the decoder says what it's doing through the
+ * callbacks it was made with. FFT plans are shared: call initFFT() once
+ * before the first decoder and freeFFT() after the last.
+ *
+ */
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+// Sample type of the spectra handed to the VU callback; FLOAT=1 builds use float
+#ifdef SLOWRX_FLOAT
+typedef float          dsp_t;
+#else
+typedef double         dsp_t;
+#endif
+
+// SSTV modes
+enum {
+  UNKNOWN=0,
+  M1,    M2,   M3,    M4,
+  S1,    S2,   SDX,
+  R72,   R36,  R24,   R24BW, R12BW, R8BW,
+  PD50,  PD90, PD120, PD160, PD180, PD240, PD290,
+  P3,    P5,   P7,
+  W2120, W2180
+};
+
+// Color encodings
+enum {
+  GBR, RGB, YUV, BW
+};
+
+typedef struct ModeSpec {
+  char   *Name;
+  char   *ShortName;
+  double  SyncTime;
+  double  PorchTime;
+  double  SeptrTime;
+  double  PixelTime;
+  double  LineTime;
+  gushort ImgWidth;
+  gushort NumLines;
+  guchar  LineHeight;
+  guchar  ColorEnc;
+} _ModeSpec;
+
+extern _ModeSpec ModeSpec[];
+
+// FM demodulators
+enum {
+  DEMOD_FFT, DEMOD_SDFT, DEMOD_HILBERT
+};
+extern char  *DemodNames[];
+
+// Slant estimators; each falls back on the ones before it
+enum {
+  SLANT_HOUGH, SLANT_FIT, SLANT_TRACK
+};
+extern char  *SlantNames[];
+
+typedef struct _Decoder Decoder;
+
+// Largest number of samples a PcmSource is asked for at once
+#define PCM_CHUNK 1024
+
+// Sample rates a decoder runs at; faster sources are decimated, slower ones suffer
+#define MINRATE   8000
+#define MAXRATE   48000
+
+// A backend that samples are captured from (sound card, file, pipe)
+typedef struct _PcmSource PcmSource;
+struct _PcmSource {
+  char    *Name;
+  gboolean Live;                                                  // samples keep coming whether read or not
+  double   Rate;                                                  // samples per second; 0 = 44100
+  int    (*Read)  (PcmSource *s, gint16 *dest, int numsamples);   // mono samples; short count = end of stream
+  void   (*Start) (PcmSource *s);                                 // optional
+  void   (*Stop)  (PcmSource *s);                                 // optional
+  void   (*Close) (PcmSource *s);                                 // optional
+  void    *Data;                                                  // the backend's own
+};
+
+/* A wideband recording split into channels, each one fed to a decoder of
+ * its own so stations sending at once are received side by side
+ */
+typedef struct _ChannelBank ChannelBank;
+
+// Where the center of a channel lies in its audio; a leader there has a HedrShift of +400 Hz
+#define CHANNEL_AUDIO 2300
+
+// The picture being received, or the last one
+typedef struct _PicMeta PicMeta;
+struct _PicMeta {
+  gshort HedrShift;
+  guchar Mode;
+  double Rate;
+  int    Skip;
+  GdkPixbuf *pixbuf;                // the picture itself, one row per line
+  GdkPixbuf *thumbbuf;              // free for the front end
+  char   timestr[40];               // UTC time of reception, for file names
+  char   fskid[20];                 // FSK ID, if any
+  double VideoTime;                 // seconds spent demodulating the video
+  gint   SlantUsed;                 // SLANT_* that gave Rate, -1 = none
+};
+
+// How a decoder goes about it; may be changed between pictures
+typedef struct _DecoderOptions DecoderOptions;
+struct _DecoderOptions {
+  gboolean Adaptive;                // adapt the FFT window to the SNR
+  guchar   DemodEngine;
+  guchar   SlantMethod;
+  gboolean AutoSlant;               // correct slant after each picture
+  gboolean FSK;                     // look for an FSK ID after each picture
+  gboolean SoftSync;                // keep sync levels, not just decisions, for the slant estimate
+  int      Rate;                    // decimate sources down towards this many samples per second, 0 = don't;
+                                    // taken when a source is opened
+};
+
+/* What a decoder tells its front end, from the decoder's thread; any of
+ * them can be NULL
+ */
+typedef struct _DecoderCallbacks DecoderCallbacks;
+struct _DecoderCallbacks {
+  gboolean (*VIS)    (Decoder *d, guchar Mode, gshort HedrShift);  // header heard; TRUE = receive it
+  void     (*Start)  (Decoder *d);                                 // reception begins, see getPic()
+  void     (*Line)   (Decoder *d, int y);                          // line y drawn; -1 = blank picture
+  void     (*FSKID)  (Decoder *d, char *id);
+  void     (*Image)  (Decoder *d, gboolean Finished);              // picture done (FALSE = cut short)
+  void     (*Status) (Decoder *d, char *text);
+  void     (*VU)     (Decoder *d, dsp_t *Power, int FFTLen, int WinIdx, gboolean ShowWin);
+};
+
+void            initFFT       (char *planner);
+void            freeFFT       ();
+int             getDemodEngine(char *name);
+int             getSlantMethod(char *name);
+
+Decoder        *newDecoder    (DecoderCallbacks *Callbacks, void *User);
+void            freeDecoder   (Decoder *d);
+DecoderOptions *getOptions    (Decoder *d);
+PicMeta        *getPic        (Decoder *d);
+void           *getUser       (Decoder *d);
+guint64         getSamplesRead(Decoder *d);
+double          getSampleRate (Decoder *d);
+
+int             initPcmFile   (Decoder *d, char *filename, char *format, int rate);
+void            openPcm       (Decoder *d, PcmSource *Source);
+void            closePcm      (Decoder *d);
+
+ChannelBank    *openChannelBank (char *filename, char *format, int rate, double Spacing, int NumChannels);
+void            openChannel   (Decoder *d, ChannelBank *b, int Channel);
+double          channelFreq   (ChannelBank *b, int Channel);
+double          channelSpacing(ChannelBank *b);
+void            closeChannelBank(ChannelBank *b);
+
+gboolean        receivePic    (Decoder *d);
+void            abortPic      (Decoder *d);
+void            startManual   (Decoder *d, guchar Mode, gshort HedrShift);
+void            resyncPic     (Decoder *d, double Rate, int Skip);
+gboolean        previewPic    (Decoder *d, double Rate, int Skip, GdkPixbuf *dest);
+void            savePic       (Decoder *d, char *dir);
+
+#endif
@@ -1,7 +1,6 @@
 #include <stdlib.h>
 #include <stdio.h>
-#include <gtk/gtk.h>
-#include <alsa/asoundlib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include <fftw3.h>
 
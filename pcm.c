@@ -1,191 +1,568 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
-#include <gtk/gtk.h>
-
-#include <alsa/asoundlib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+#include <pthread.h>
 
 #include <fftw3.h>
 
 #include "common.h"
 
 /*
- * Stuff related to sound card capture
+ * Stuff related to getting PCM data into the decoder
+ *
+ * A capture thread reads the source into a lock-free single-producer,
+ * single-consumer ring that holds several seconds of audio. The decoder
+ * thread only ever reads from the ring, so a slow FFT or GUI update
+ * doesn't overrun the sound card, and the decoder catches up afterwards
+ * as fast as it can.
+ *
+ * The ring is mapped twice back to back in virtual memory, so any window
+ * of it is contiguous even where it wraps around. pcm->Buffer simply points
+ * at the last BUFLEN samples handed to the decoder: nothing is copied or
+ * shifted on read, and sources write straight into the ring.
+ *
+ * Every decoder has its own ring and capture thread.
+ *
+ * Sources faster than the decoder needs are decimated on the way into the
+ * ring by a whole factor, towards DecoderOptions.Rate: a Kaiser low-pass
+ * halfway down at the new Nyquist frequency, computed only for the samples
+ * that are kept. SSTV stays below 3.4 kHz, so 11025 Hz loses nothing and
+ * every later stage has a quarter of the samples to go through.
  *
  */
 
-// Capture fresh PCM data to buffer
-void readPcm(gint numsamples) {
+#define RINGLEN    (1 << 18)  // ~6 s at 44.1 kHz; power of two, multiple of the page size
+#define DECIM_ATTEN 70.0      // stop band attenuation of the decimator in dB
 
-  int    samplesread, i;
-  gint32 tmp[BUFLEN];  // Holds one or two 16-bit channels, will be ANDed to single channel
+// Map the ring twice in a row onto the same memory
+static gint16 *allocMirrored(size_t len) {
 
-  samplesread = snd_pcm_readi(pcm.handle, tmp, (pcm.WindowPtr == 0 ? BUFLEN : numsamples));
+  int    fd;
+  guchar *base;
 
-  if (samplesread < numsamples) {
-    
-    if      (samplesread == -EPIPE)
-      printf("ALSA: buffer overrun\n");
-    else if (samplesread < 0) {
-      printf("ALSA error %d (%s)\n", samplesread, snd_strerror(samplesread));
-      gtk_widget_set_tooltip_text(gui.image_devstatus, "ALSA error");
-      Abort = TRUE;
-      pthread_exit(NULL);
-    }
-    else
-      printf("Can't read %d samples\n", numsamples);
-    
-    // On first appearance of error, update the status icon
-    if (!pcm.BufferDrop) {
-      gdk_threads_enter();
-      gtk_image_set_from_stock(GTK_IMAGE(gui.image_devstatus),GTK_STOCK_DIALOG_WARNING,GTK_ICON_SIZE_SMALL_TOOLBAR);
-      gtk_widget_set_tooltip_text(gui.image_devstatus, "Device is dropping samples");
-      gdk_threads_leave();
-      pcm.BufferDrop = TRUE;
-    }
+  fd = memfd_create("slowrx-ring", 0);
+  if (fd < 0 || ftruncate(fd, len) != 0) return NULL;
 
+  base = mmap(NULL, 2 * len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED ||
+      mmap(base,       len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED ||
+      mmap(base + len, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+    close(fd);
+    return NULL;
   }
 
-  if (pcm.WindowPtr == 0) {
-    // Fill buffer on first run
-    for (i=0; i<BUFLEN; i++)
-      pcm.Buffer[i] = tmp[i] & 0xffff;
-    pcm.WindowPtr = BUFLEN/2;
-  } else {
+  close(fd);
+  return (gint16*)base;
+}
+
+// Low-pass n source samples and keep every Factor-th; returns the number kept
+static int decimate(PcmData *pcm, gint16 *src, int n, gint16 *dest) {
+
+  int    i, k, kept = 0, H = pcm->NumTaps - 1;
+  dsp_t *x = pcm->Hist, acc;
+
+  for (i = 0; i < n; i++) x[H + i] = src[i];
+
+  for (i = pcm->Phase; i < n; i += pcm->Factor) {
+    acc = 0;
+    for (k = 0; k < pcm->NumTaps; k++) acc += pcm->Taps[k] * x[i + k];
+    dest[kept++] = (acc >= 32767 ? 32767 : (acc <= -32768 ? -32768 : acc));
+  }
+  pcm->Phase = i - n;
+
+  memmove(x, x + n, sizeof(dsp_t) * H);
+
+  return kept;
+}
+
+// Set up decimation by Factor, 1 for none
+static void setDecimation(PcmData *pcm, int Factor) {
 
-    // Move buffer and push samples
-    for (i=0; i<BUFLEN-numsamples;      i++) pcm.Buffer[i] = pcm.Buffer[i+numsamples];
-    for (i=BUFLEN-numsamples; i<BUFLEN; i++) pcm.Buffer[i] = tmp[i-(BUFLEN-numsamples)] & 0xffff;
+  free(pcm->Taps);
+  free(pcm->Hist);
+  pcm->Taps   = pcm->Hist = NULL;
+  pcm->Factor = Factor;
+  pcm->Phase  = 0;
 
-    pcm.WindowPtr -= numsamples;
+  if (Factor == 1) return;
+
+  // Pass band to 0.4, stop band from 0.6 of the new rate
+  pcm->NumTaps = (int)ceil((DECIM_ATTEN - 8) / (14.36 * 0.2) * Factor) | 1;
+  pcm->Taps    = malloc(sizeof(dsp_t) * pcm->NumTaps);
+  pcm->Hist    = calloc(pcm->NumTaps - 1 + PCM_CHUNK, sizeof(dsp_t));
+  if (pcm->Taps == NULL || pcm->Hist == NULL) {
+    perror("setDecimation: Unable to allocate memory for decimator");
+    exit(EXIT_FAILURE);
   }
 
+  kaiserLowpass(pcm->Taps, pcm->NumTaps, 0.5 / Factor, DECIM_ATTEN);
 }
 
-void populateDeviceList() {
-  int                  card;
-  char                *cardname;
-  int                  numcards, row;
+// Capture thread: keep the ring filled
+static void *capture(void *arg) {
+
+  PcmData   *pcm = arg;
+  PcmSource *src = pcm->Source;
+  gint16     scratch[PCM_CHUNK];
+  int        n;
+  guint      head, room;
+
+  if (src->Start != NULL) src->Start(src);
+
+  while (!g_atomic_int_get(&pcm->CaptureQuit)) {
+
+    // The decoder may still be looking at the last BUFLEN samples it got
+    head = pcm->Head;
+    room = RINGLEN - BUFLEN - (head - (guint)g_atomic_int_get(&pcm->Tail));
+
+    if (room < PCM_CHUNK || g_atomic_int_get(&pcm->CapturePaused)) {
+
+      // Wait for room (files) or throw the samples away (live devices)
+      if (!src->Live) {
+        g_usleep(1000);
+        continue;
+      }
+
+      n = src->Read(src, scratch, PCM_CHUNK);
+      if (room < PCM_CHUNK && !g_atomic_int_get(&pcm->CapturePaused)) {
+        if (!pcm->BufferDrop) printf("Decoder too slow, dropping samples\n");
+        pcm->BufferDrop = TRUE;
+      }
+
+    } else if (pcm->Factor > 1) {
+
+      n = src->Read(src, scratch, PCM_CHUNK);
+      if (n < 0) n = 0;
+      g_atomic_int_set(&pcm->Head, head + decimate(pcm, scratch, n, pcm->Ring + (head & (RINGLEN-1))));
+
+    } else {
+
+      n = src->Read(src, pcm->Ring + (head & (RINGLEN-1)), PCM_CHUNK);
+      if (n < 0) n = 0;
+      g_atomic_int_set(&pcm->Head, head + n);
+
+    }
+
+    if (n < PCM_CHUNK) {
+      g_atomic_int_set(&pcm->CaptureEOF, TRUE);
+      break;
+    }
+  }
 
-  gdk_threads_enter();
-  gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(gui.combo_card), "default");
-  gdk_threads_leave();
+  if (src->Stop != NULL) src->Stop(src);
 
-  numcards = 0;
-  card     = -1;
-  row      = 0;
-  do {
-    snd_card_next(&card);
-    if (card != -1) {
-      row++;
-      snd_card_get_name(card,&cardname);
-      gdk_threads_enter();
-      gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(gui.combo_card), cardname);
-      char *dev = g_key_file_get_string(config,"slowrx","device",NULL);
-      if (dev == NULL || strcmp(cardname, dev) == 0)
-        gtk_combo_box_set_active(GTK_COMBO_BOX(gui.combo_card), row);
+  return NULL;
+}
 
-      gdk_threads_leave();
-      numcards++;
+// Hand the next numsamples samples to the decoder
+void readPcm(Decoder *d, gint numsamples) {
+
+  PcmData *pcm  = &d->pcm;
+  guint    tail = pcm->Tail, head;
+  int      i;
+
+  if (pcm->WindowPtr == 0) numsamples = BUFLEN;
+
+  // Wait for the capture thread if needed
+  while (TRUE) {
+    gboolean eof = g_atomic_int_get(&pcm->CaptureEOF);
+    head = g_atomic_int_get(&pcm->Head);
+    if (head - tail >= (guint)numsamples) break;
+
+    if (eof) {
+      // End of stream: pad with silence and tell the decoder to stop, as
+      // many times as it asks. The capture thread is gone, so the ring is
+      // ours to write; the silence counts as captured so that Tail never
+      // gets past Head.
+      for (i = head - tail; i < numsamples; i++) pcm->Ring[(tail + i) & (RINGLEN-1)] = 0;
+      g_atomic_int_set(&pcm->Head, tail + numsamples);
+      pcm->EndOfStream = TRUE;
+      d->Abort         = TRUE;
+      break;
     }
-  } while (card != -1);
 
-  if (numcards == 0) {
-    perror("No sound devices found!\n");
+    // Aborted by the user; the caller bails out before looking at the buffer
+    if (d->Abort) return;
+
+    g_usleep(1000);
+  }
+
+  tail += numsamples;
+  g_atomic_int_set(&pcm->Tail, tail);
+
+  pcm->Buffer       = pcm->Ring + ((tail - BUFLEN) & (RINGLEN-1));
+  pcm->SamplesRead += numsamples;
+
+  if (pcm->WindowPtr == 0) pcm->WindowPtr  = BUFLEN/2;
+  else                     pcm->WindowPtr -= numsamples;
+
+}
+
+/* Start capturing from a freshly opened source, decimated towards
+ * Options.Rate but within MINRATE..MAXRATE
+ */
+void openPcm(Decoder *d, PcmSource *Source) {
+
+  PcmData *pcm = &d->pcm;
+  double   SourceRate = (Source->Rate > 0 ? Source->Rate : 44100);
+  int      Factor;
+
+  closePcm(d);
+
+  Factor = (d->Options.Rate > 0 ? (int)(SourceRate / d->Options.Rate) : 1);
+  while (SourceRate / Factor > MAXRATE)           Factor ++;
+  while (Factor > 1 && SourceRate / Factor < MINRATE) Factor --;
+  setDecimation(pcm, MAX(Factor, 1));
+  d->SampleRate = SourceRate / pcm->Factor;
+  planSizes(d);
+
+  if (pcm->Ring == NULL) {
+    pcm->Ring = allocMirrored(RINGLEN * sizeof(gint16));
+    if (pcm->Ring == NULL) {
+      perror("openPcm: Unable to map ring buffer");
+      exit(EXIT_FAILURE);
+    }
+  }
+  memset(pcm->Ring, 0, RINGLEN * sizeof(gint16));
+
+  pcm->Buffer      = pcm->Ring + RINGLEN - BUFLEN;
+  pcm->Source      = Source;
+  pcm->WindowPtr   = 0;
+  pcm->SamplesRead = 0;
+  pcm->EndOfStream = FALSE;
+  pcm->BufferDrop  = FALSE;
+
+  pcm->Head          = pcm->Tail = 0;
+  pcm->CaptureEOF    = FALSE;
+  pcm->CaptureQuit   = FALSE;
+  pcm->CapturePaused = FALSE;
+
+  if (pthread_create(&pcm->CaptureThread, NULL, capture, pcm) != 0) {
+    perror("openPcm: Unable to start capture thread");
     exit(EXIT_FAILURE);
   }
-  
+  pcm->Capturing = TRUE;
 }
 
-// Initialize sound card
-// Return value:
-//   0 = opened ok
-//  -1 = opened, but suboptimal
-//  -2 = couldn't be opened
-int initPcmDevice(char *wanteddevname) {
+// (Re)start listening from an empty buffer
+void startPcm(Decoder *d) {
+  d->pcm.WindowPtr = 0;
 
-  snd_pcm_hw_params_t *hwparams;
-  char                 pcm_name[30];
-  unsigned int         exact_rate = 44100;
-  int                  card;
-  gboolean             found;
-  char                *cardname;
+  // Whatever a live source captured meanwhile is stale
+  if (d->pcm.Source->Live) g_atomic_int_set(&d->pcm.Tail, g_atomic_int_get(&d->pcm.Head));
+  g_atomic_int_set(&d->pcm.CapturePaused, FALSE);
+}
 
-  pcm.BufferDrop = FALSE;
+// Stop listening for a while; live sources drop what arrives meanwhile
+void stopPcm(Decoder *d) {
+  if (d->pcm.Source->Live) g_atomic_int_set(&d->pcm.CapturePaused, TRUE);
+}
 
-  snd_pcm_hw_params_alloca(&hwparams);
+// Stop capturing and close the source
+void closePcm(Decoder *d) {
 
-  card  = -1;
-  found = FALSE;
-  if (strcmp(wanteddevname,"default") == 0) {
-    found=TRUE;
-  } else {
-    do {
-      snd_card_next(&card);
-      if (card != -1) {
-        snd_card_get_name(card,&cardname);
-        if (strcmp(cardname, wanteddevname) == 0) {
-          found=TRUE;
-          break;
-        }
-      }
-    } while (card != -1);
+  PcmData *pcm = &d->pcm;
+
+  if (pcm->Capturing) {
+    g_atomic_int_set(&pcm->CaptureQuit, TRUE);
+    pthread_join(pcm->CaptureThread, NULL);
+    pcm->Capturing = FALSE;
   }
+  if (pcm->Source != NULL && pcm->Source->Close != NULL) pcm->Source->Close(pcm->Source);
+  pcm->Source = NULL;
+}
 
-  if (!found) {
-    perror("Device disconnected?\n");
-    return(-2);
+// Close the source and give back the ring
+void freePcm(Decoder *d) {
+  closePcm(d);
+  if (d->pcm.Ring != NULL) munmap(d->pcm.Ring, 2 * RINGLEN * sizeof(gint16));
+  d->pcm.Ring = NULL;
+  setDecimation(&d->pcm, 1);
+}
+
+
+/*
+ * Audio files, FIFOs and stdin
+ *
+ * WAV (16-bit integer or 32-bit float) or headerless raw S16_LE / FLOAT_LE.
+ * Only the first channel is used. Nothing is seeked, so pipes work too.
+ * The channelizer also reads rtl_sdr's unsigned 8-bit IQ (CU8).
+ *
+ */
+
+enum {
+  FMT_S16, FMT_F32, FMT_CU8
+};
+
+struct _PcmFile {
+  FILE  *File;
+  int    Format;
+  int    Channels;
+  guchar Pending[4];                 // Bytes peeked at while detecting the format
+  int    PendingLen;
+};
+
+static guint32 le32 (guchar *b) { return b[0] | (b[1] << 8) | (b[2] << 16) | ((guint32)b[3] << 24); }
+static gushort le16 (guchar *b) { return b[0] | (b[1] << 8); }
+
+// fread() that first hands out the peeked bytes
+static size_t readBytes(PcmFile *f, guchar *dest, size_t len) {
+  size_t n = 0;
+
+  while (f->PendingLen > 0 && n < len) {
+    dest[n++] = f->Pending[0];
+    memmove(f->Pending, f->Pending+1, --f->PendingLen);
   }
 
-  if (strcmp(wanteddevname,"default") == 0) {
-    sprintf(pcm_name,"default");
-  } else {
-    sprintf(pcm_name,"hw:%d",card);
+  return n + fread(dest + n, 1, len - n, f->File);
+}
+
+// Read samples from the file without any pacing, keeping only the first
+// channel (in one pass per format, so the compiler can vectorize it)
+static int readSamples(PcmFile *pf, gint16 *dest, int numsamples) {
+
+  int      i, framesize, framesread;
+  size_t   bytesread, wanted;
+  guchar  *raw;
+  union {
+    guchar b[PCM_CHUNK * 8 * 4];
+    gint16 s[PCM_CHUNK * 8 * 2];
+    float  f[PCM_CHUNK * 8];
+  } tmp;
+
+  framesize  = (pf->Format == FMT_F32 ? 4 : 2) * pf->Channels;
+  wanted     = (size_t)framesize * numsamples;
+
+  // Mono S16 goes straight to its destination
+  raw        = (pf->Format == FMT_S16 && pf->Channels == 1) ? (guchar*)dest : tmp.b;
+  bytesread  = readBytes(pf, raw, wanted);
+
+  // A pipe may deliver less than asked for; only EOF ends the stream
+  while (bytesread < wanted && !feof(pf->File) && !ferror(pf->File))
+    bytesread += fread(raw + bytesread, 1, wanted - bytesread, pf->File);
+
+  framesread = bytesread / framesize;
+
+  if (pf->Format == FMT_F32) {
+    for (i = 0; i < framesread; i++) {
+      float f = tmp.f[i * pf->Channels] * 32768;
+      dest[i] = (f >= 32767 ? 32767 : (f <= -32768 ? -32768 : f));
+    }
+  } else if (raw == tmp.b) {
+    for (i = 0; i < framesread; i++)
+      dest[i] = tmp.s[i * pf->Channels];
   }
-  
-  if (snd_pcm_open(&pcm.handle, pcm_name, SND_PCM_STREAM_CAPTURE, 0) < 0) {
-    perror("ALSA: Error opening PCM device");
-    return(-2);
+
+  return framesread;
+
+}
+
+static int readFile(PcmSource *s, gint16 *dest, int numsamples) {
+  return readSamples(s->Data, dest, numsamples);
+}
+
+/* Read numsamples complex samples for the channelizer, on the scale of
+ * 16-bit audio: IQ pairs from CU8 files, or audio with nothing imaginary
+ *   returns  the number read; short at the end of the file
+ */
+int readWide(PcmFile *f, dsp_complex *dest, int numsamples) {
+
+  int     i, n, want, got = 0;
+  size_t  bytesread;
+  union {
+    guchar b[PCM_CHUNK * 2];
+    gint16 s[PCM_CHUNK];
+  } tmp;
+
+  while (got < numsamples) {
+    want = n = MIN(numsamples - got, PCM_CHUNK);
+
+    if (f->Format == FMT_CU8) {
+      bytesread = readBytes(f, tmp.b, 2 * n);
+      while (bytesread < 2 * (size_t)n && !feof(f->File) && !ferror(f->File))
+        bytesread += fread(tmp.b + bytesread, 1, 2 * n - bytesread, f->File);
+      n = bytesread / 2;
+      for (i = 0; i < n; i++) {
+        dest[got+i][0] = (tmp.b[2*i]   - 127.5) * 256;
+        dest[got+i][1] = (tmp.b[2*i+1] - 127.5) * 256;
+      }
+    } else {
+      n = readSamples(f, tmp.s, n);
+      for (i = 0; i < n; i++) {
+        dest[got+i][0] = tmp.s[i];
+        dest[got+i][1] = 0;
+      }
+    }
+
+    got += n;
+    if (n < want) break;
   }
 
-  /* Init hwparams with full configuration space */
-  if (snd_pcm_hw_params_any(pcm.handle, hwparams) < 0) {
-    perror("ALSA: Can not configure this PCM device.");
-    return(-2);
+  return got;
+}
+
+// Parse the RIFF header up to the beginning of the data chunk
+static int readWavHeader(PcmFile *f, int *rate) {
+
+  guchar   hdr[40];
+  guint32  chunklen, i;
+  gushort  fmt = 0, bits = 0;
+
+  if (readBytes(f, hdr, 12) != 12 || memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr+8, "WAVE", 4) != 0)
+    return -1;
+
+  while (readBytes(f, hdr, 8) == 8) {
+    chunklen = le32(hdr+4);
+
+    if (memcmp(hdr, "fmt ", 4) == 0) {
+      if (chunklen < 16 || chunklen > sizeof(hdr) || readBytes(f, hdr, chunklen) != chunklen)
+        return -1;
+      fmt          = le16(hdr);
+      f->Channels  = le16(hdr+2);
+      *rate        = le32(hdr+4);
+      bits         = le16(hdr+14);
+
+      // WAVE_FORMAT_EXTENSIBLE: the actual format is in the subformat GUID
+      if (fmt == 0xfffe && chunklen >= 26) fmt = le16(hdr+24);
+
+    } else if (memcmp(hdr, "data", 4) == 0) {
+      if      (fmt == 1 && bits == 16) f->Format = FMT_S16;
+      else if (fmt == 3 && bits == 32) f->Format = FMT_F32;
+      else {
+        fprintf(stderr, "WAV: Unsupported sample format %d (%d bits)\n", fmt, bits);
+        return -1;
+      }
+      return (f->Channels > 0 && f->Channels <= 8) ? 0 : -1;
+
+    } else {
+      // Skip unknown chunk (padded to even length)
+      for (i = 0; i < chunklen + (chunklen & 1); i++)
+        if (fgetc(f->File) == EOF) return -1;
+    }
   }
 
-  if (snd_pcm_hw_params_set_access(pcm.handle, hwparams, SND_PCM_ACCESS_RW_INTERLEAVED) < 0) {
-    perror("ALSA: Error setting interleaved access.");
+  return -1;
+}
+
+static void closeFile(PcmSource *s) {
+  PcmFile *f = s->Data;
+  if (f->File != NULL && f->File != stdin) fclose(f->File);
+  f->File = NULL;
+}
+
+/* Open filename and read its header into f
+ *   format:  "wav", "s16", "f32" or (Wide only) "cu8"; NULL = detect WAV or assume raw S16
+ *   rate:    of raw files; replaced by that of WAV files
+ *   returns  0, or -2 if the file couldn't be opened
+ */
+static int openFile(PcmFile *f, char *filename, char *format, int *rate, gboolean Wide) {
+
+  f->File       = (strcmp(filename, "-") == 0 ? stdin : fopen(filename, "rb"));
+  f->PendingLen = 0;
+  if (f->File == NULL) {
+    perror("Unable to open audio file");
     return(-2);
   }
-  if (snd_pcm_hw_params_set_format(pcm.handle, hwparams, SND_PCM_FORMAT_S16_LE) < 0) {
-    perror("ALSA: Error setting format S16_LE.");
-    return(-2);
+
+  if (format == NULL) {
+    f->PendingLen = fread(f->Pending, 1, 4, f->File);
+    format        = (f->PendingLen == 4 && memcmp(f->Pending, "RIFF", 4) == 0) ? "wav" : "s16";
   }
-  if (snd_pcm_hw_params_set_rate_near(pcm.handle, hwparams, &exact_rate, 0) < 0) {
-    perror("ALSA: Error setting sample rate.");
+
+  f->Channels = 1;
+  if (strcmp(format, "wav") == 0) {
+    if (readWavHeader(f, rate) < 0) {
+      fprintf(stderr, "%s: Not a supported WAV file\n", filename);
+      if (f->File != stdin) fclose(f->File);
+      return(-2);
+    }
+  } else if (strcmp(format, "s16") == 0) {
+    f->Format = FMT_S16;
+  } else if (strcmp(format, "f32") == 0) {
+    f->Format = FMT_F32;
+  } else if (strcmp(format, "cu8") == 0 && Wide) {
+    f->Format = FMT_CU8;
+  } else {
+    fprintf(stderr, "Unknown sample format '%s'\n", format);
+    if (f->File != stdin) fclose(f->File);
     return(-2);
   }
 
-  // Try stereo first
-  if (snd_pcm_hw_params_set_channels(pcm.handle, hwparams, 2) < 0) {
-    // Fall back to mono
-    if (snd_pcm_hw_params_set_channels(pcm.handle, hwparams, 1) < 0) {
-      perror("ALSA: Error setting channels.");
-      return(-2);
+  return(0);
+}
+
+/* Open a recording for the channelizer
+ *   Complex:  set if it's IQ
+ *   returns   NULL if it couldn't be opened
+ */
+PcmFile *openWideFile(char *filename, char *format, int *rate, gboolean *Complex) {
+
+  PcmFile *f = calloc(1, sizeof(PcmFile));
+
+  if (f == NULL) {
+    perror("openWideFile: Unable to allocate memory for file");
+    exit(EXIT_FAILURE);
+  }
+
+  if (openFile(f, filename, format, rate, TRUE) < 0) {
+    free(f);
+    return NULL;
+  }
+
+  *Complex = (f->Format == FMT_CU8);
+  return f;
+}
+
+void closeWideFile(PcmFile *f) {
+  if (f->File != NULL && f->File != stdin) fclose(f->File);
+  free(f);
+}
+
+// Open an audio file for decoding by d
+//   filename: path to a file or FIFO, or "-" for stdin
+//   format:   "wav", "s16" or "f32"; NULL = detect WAV or assume raw S16
+//   rate:     sample rate of raw files
+// Return value:
+//   0 = opened ok
+//  -1 = opened, but suboptimal
+//  -2 = couldn't be opened
+int initPcmFile(Decoder *d, char *filename, char *format, int rate) {
+
+  PcmSource *s;
+  PcmFile   *f;
+
+  closePcm(d);
+
+  // Made once per decoder, and reused for every file
+  if (d->FileSource == NULL) {
+    d->FileSource = calloc(1, sizeof(PcmSource));
+    if (d->FileSource == NULL || (d->FileSource->Data = calloc(1, sizeof(PcmFile))) == NULL) {
+      perror("initPcmFile: Unable to allocate memory for file source");
+      exit(EXIT_FAILURE);
     }
+    d->FileSource->Name  = "file";
+    d->FileSource->Read  = readFile;
+    d->FileSource->Close = closeFile;
   }
-  if (snd_pcm_hw_params(pcm.handle, hwparams) < 0) {
-    perror("ALSA: Error setting HW params.");
+  s = d->FileSource;
+  f = s->Data;
+
+  if (openFile(f, filename, format, &rate, FALSE) < 0) {
+    f->File = NULL;
     return(-2);
   }
 
-  pcm.Buffer = calloc( BUFLEN, sizeof(gint16));
-  memset(pcm.Buffer, 0, BUFLEN);
-  
-  if (exact_rate != 44100) {
-    fprintf(stderr, "ALSA: Got %d Hz instead of 44100. Expect artifacts.\n", exact_rate);
+  s->Rate = rate;
+  openPcm(d, s);
+
+  if (rate < MINRATE) {
+    fprintf(stderr, "%s: Sample rate is only %d Hz. Expect artifacts.\n", filename, rate);
     return(-1);
   }
 
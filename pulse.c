@@ -0,0 +1,203 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Matched filter for the sync pulses
+ *
+ * Correlates the audio with a tone burst at the sync frequency that is one
+ * sync pulse long, using overlap-save: blocks of N samples, the first Len-1
+ * of them kept from the previous block, go through a complex FFT, are
+ * multiplied by the transformed time-reversed conjugate burst and come back
+ * with N-Len+1 new outputs. Each output y[n] covers the Len samples ending at
+ * n, so |y| rises and falls around the last sample of a pulse.
+ *
+ * A pulse is an output where the burst explains at least PULSE_THRESH of the
+ * power in its window, with no better one within a pulse length after it.
+ * Over a few samples the 1500 Hz porches on either side look much like the
+ * sync tone, which flattens the top of the peak; its centroid rather than the
+ * single highest output places the pulse, to a fraction of a sample.
+ *
+ * The phase drift between the two halves of the pulse gives its frequency,
+ * for following HedrShift.
+ *
+ */
+
+#define PULSE_THRESH 0.3
+#define PULSE_TOP    0.8          // share of the peak magnitude that counts as its top
+
+// Frequency of the Len samples from Start on, from the phase drift between halves
+static double pulseFreq(PulseFilter *p, int Start) {
+
+  int    m, h = p->Len / 2;
+  double w = 2 * M_PI * p->Freq / p->Rate, x, re[2] = {0}, im[2] = {0}, d;
+
+  for (m = 0; m < 2 * h; m++) {
+    x = p->Raw[(Start + m) & p->RawMask];
+    re[m / h] += x * cos(w * m);
+    im[m / h] -= x * sin(w * m);
+  }
+
+  // Second half against the first, h samples on
+  d = atan2(im[1] * re[0] - re[1] * im[0], re[1] * re[0] + im[1] * im[0]);
+
+  return p->Freq + d / h * p->Rate / (2 * M_PI);
+}
+
+// Record a pulse starting Len-1 samples before the centroid of the peak
+static void emitPeak(PulseFilter *p) {
+
+  int    n;
+  double m, w, Sw = 0, Swn = 0, Start, Floor = PULSE_TOP * p->Mag[p->PeakPos & p->MagMask];
+
+  for (n = p->PeakPos - p->Len/2; n <= p->PeakPos + p->Len/2 && n <= p->Last; n++) {
+    m = p->Mag[n & p->MagMask];
+    if (m > Floor) {
+      w    = m - Floor;
+      Sw  += w;
+      Swn += w * (n - p->PeakPos);
+    }
+  }
+
+  Start = p->PeakPos + (Sw > 0 ? Swn / Sw : 0) - (p->Len - 1);
+  storePulse(p->Dec, Start, pulseFreq(p, round(Start)));
+  p->PeakRho = 0;
+}
+
+// Follow output n: magnitude and share of the window power explained
+static void follow(PulseFilter *p, int n, double mag, double rho) {
+
+  p->Mag[n & p->MagMask] = mag;
+  p->Last                = n;
+
+  if (rho >= PULSE_THRESH && rho > p->PeakRho) {
+    p->PeakRho = rho;
+    p->PeakPos = n;
+  }
+
+  if (p->PeakRho > 0 && n >= p->PeakPos + p->Len) emitPeak(p);
+}
+
+// Filter the block in p->x; outputs past Valid samples are thrown away
+static void runBlock(PulseFilter *p, int Valid) {
+
+  int    n, N = p->N, Hist = p->Len - 1;
+  double e = 0, mag, rho, re, im;
+
+  for (n = 0; n < N; n++) {
+    p->buf[n][0] = p->x[n];
+    p->buf[n][1] = 0;
+  }
+
+  FFTW(execute_dft)(p->Fwd, p->buf, p->buf);
+
+  for (n = 0; n < N; n++) {
+    re = p->buf[n][0] * p->Kern[n][0] - p->buf[n][1] * p->Kern[n][1];
+    im = p->buf[n][0] * p->Kern[n][1] + p->buf[n][1] * p->Kern[n][0];
+    p->buf[n][0] = re;
+    p->buf[n][1] = im;
+  }
+
+  FFTW(execute_dft)(p->Inv, p->buf, p->buf);
+
+  // Power in the window ending at n, summed afresh for every block
+  for (n = 0; n < Hist; n++) e += p->x[n] * p->x[n];
+
+  for (n = Hist; n < Valid; n++) {
+    e  += p->x[n] * p->x[n];
+    mag = sqrt(power(p->buf[n])) / N;
+    // A real tone only puts half its power at the positive frequency
+    rho = (e > 1e-9 ? 2 * mag * mag / (p->Len * e) : 0);
+    follow(p, p->Count + n, mag, rho);
+    e  -= p->x[n - Hist] * p->x[n - Hist];
+  }
+
+  // Keep the tail as the history of the next block
+  memmove(p->x, p->x + N - Hist, sizeof(dsp_t) * Hist);
+  p->Count += N - Hist;
+  p->Fill   = Hist;
+}
+
+/* Prepare for pulses PulseTime seconds long at Freq Hz, to be stored in d;
+ * the first sample fed is sample 0
+ */
+void initPulse(PulseFilter *p, Decoder *d, double PulseTime, double Freq) {
+
+  int    m;
+  double w = 2 * M_PI * Freq / d->SampleRate;
+
+  p->Dec  = d;
+  p->Rate = d->SampleRate;
+  p->Len  = round(PulseTime * p->Rate);
+  p->Freq = Freq;
+  for (p->N = 256; p->N < 4 * p->Len; p->N *= 2) ;
+
+  // Enough outputs to look back half a pulse from a pulse length on, and
+  // enough samples to go back from there over the pulse and a block
+  for (p->MagMask = 1; p->MagMask < 2 * p->Len; p->MagMask *= 2) ;
+  for (p->RawMask = 1; p->RawMask < 3 * p->Len + p->N; p->RawMask *= 2) ;
+
+  p->x    = FFTW(alloc_real)(p->N);
+  p->Kern = FFTW(alloc_complex)(p->N);
+  p->buf  = FFTW(alloc_complex)(p->N);
+  p->Mag  = calloc(p->MagMask, sizeof(double));
+  p->Raw  = calloc(p->RawMask, sizeof(gint16));
+  p->MagMask --;
+  p->RawMask --;
+  if (p->x == NULL || p->Kern == NULL || p->buf == NULL || p->Mag == NULL || p->Raw == NULL) {
+    perror("initPulse: Unable to allocate memory for matched filter");
+    exit(EXIT_FAILURE);
+  }
+
+  p->Fwd = getComplexPlan(p->N, FFTW_FORWARD);
+  p->Inv = getComplexPlan(p->N, FFTW_BACKWARD);
+
+  // g[m] = conj(burst[Len-1-m]) = e^(-jw(Len-1-m))
+  for (m = 0; m < p->N; m++) p->Kern[m][0] = p->Kern[m][1] = 0;
+  for (m = 0; m < p->Len; m++) {
+    p->Kern[m][0] =  cos(w * (p->Len - 1 - m));
+    p->Kern[m][1] = -sin(w * (p->Len - 1 - m));
+  }
+  FFTW(execute_dft)(p->Fwd, p->Kern, p->Kern);
+
+  // Silence before the first sample
+  memset(p->x, 0, sizeof(dsp_t) * p->N);
+  p->Fill    = p->Len - 1;
+  p->Count   = -(p->Len - 1);
+  p->PeakRho = 0;
+  p->Last    = 0;
+  p->Fed     = 0;
+}
+
+// Feed the next sample
+void feedPulse(PulseFilter *p, gint16 sample) {
+  p->Raw[p->Fed++ & p->RawMask] = sample;
+  p->x[p->Fill++] = sample / 32768.0;
+  if (p->Fill == p->N) runBlock(p, p->N);
+}
+
+// Filter what's left and report the last pulse
+void flushPulse(PulseFilter *p) {
+
+  int Fill = p->Fill;
+
+  if (Fill > p->Len - 1) {
+    memset(p->x + Fill, 0, sizeof(dsp_t) * (p->N - Fill));
+    runBlock(p, Fill);
+  }
+  if (p->PeakRho > 0) emitPeak(p);
+}
+
+void freePulse(PulseFilter *p) {
+  FFTW(free)(p->x);
+  FFTW(free)(p->Kern);
+  FFTW(free)(p->buf);
+  free(p->Mag);
+  free(p->Raw);
+}
@@ -0,0 +1,84 @@
+#include <stdlib.h>
+#include <math.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Sliding DFT over the video band
+ *
+ * Gives the same Hann-windowed, zero-padded spectrum as the FFT in
+ * GetVideo(), but only for the bins LoBin..HiBin, updated one sample at a
+ * time instead of recomputed from scratch.
+ *
+ * For a window of N samples starting at s, the rectangular DTFT at w is
+ *   S(w) = sum x[s+m] e^(-jwm),  m = 0..N-1
+ * and moving the window by one sample is
+ *   S'(w) = e^(jw) (S(w) - x[s]) + x[s+N] e^(-jw(N-1))
+ * The Hann window 0.5 - 0.5 cos(2 pi m/(N-1)) is three exponentials, so the
+ * windowed coefficient is 0.5 S(w) - 0.25 S(w-d) - 0.25 S(w+d), d = 2 pi/(N-1).
+ *
+ */
+
+// Recompute all sums directly for the window centered at *center
+void initSDFT(SlidingDFT *s, gint16 *center, int WinLen, guint FFTLen, guint LoBin, guint HiBin) {
+
+  int    k, m, f;
+  double w, x;
+
+  s->WinLen   = WinLen;
+  s->LoBin    = LoBin;
+  s->HiBin    = (HiBin - LoBin >= SDFT_MAXBINS ? LoBin + SDFT_MAXBINS - 1 : HiBin);
+  s->Age      = 0;
+
+  for (k = 0; k <= (int)(s->HiBin - s->LoBin); k++) {
+    for (f = 0; f < 3; f++) {
+      w = 2 * M_PI * (k + LoBin) / FFTLen + (f - 1) * 2 * M_PI / (WinLen - 1);
+      s->RotRe[k][f] = cos(w);
+      s->RotIm[k][f] = sin(w);
+      s->EndRe[k][f] = cos(w * (WinLen - 1));
+      s->EndIm[k][f] = -sin(w * (WinLen - 1));
+      s->Re[k][f] = s->Im[k][f] = 0;
+      for (m = 0; m < WinLen; m++) {
+        x = center[m - WinLen/2] / 32768.0;
+        s->Re[k][f] += x * cos(w * m);
+        s->Im[k][f] -= x * sin(w * m);
+      }
+    }
+  }
+}
+
+// Move the window forward by one sample, to be centered at *center
+void slideSDFT(SlidingDFT *s, gint16 *center) {
+
+  int    k, f, N = s->WinLen;
+  double xold = center[-N/2 - 1]    / 32768.0;
+  double xnew = center[N - N/2 - 1] / 32768.0;
+  double re, im;
+
+  for (k = 0; k <= (int)(s->HiBin - s->LoBin); k++) {
+    for (f = 0; f < 3; f++) {
+      re = s->Re[k][f] - xold;
+      im = s->Im[k][f];
+      s->Re[k][f] = re * s->RotRe[k][f] - im * s->RotIm[k][f] + xnew * s->EndRe[k][f];
+      s->Im[k][f] = re * s->RotIm[k][f] + im * s->RotRe[k][f] + xnew * s->EndIm[k][f];
+    }
+  }
+
+  s->Age ++;
+}
+
+// Hann-windowed power of bins LoBin..HiBin
+void powerSDFT(SlidingDFT *s, dsp_t *Power) {
+
+  int    k;
+  double re, im;
+
+  for (k = 0; k <= (int)(s->HiBin - s->LoBin); k++) {
+    re = 0.5 * s->Re[k][1] - 0.25 * (s->Re[k][0] + s->Re[k][2]);
+    im = 0.5 * s->Im[k][1] - 0.25 * (s->Im[k][0] + s->Im[k][2]);
+    Power[k + s->LoBin] = re*re + im*im;
+  }
+}
@@ -0,0 +1,99 @@
+#include <stdlib.h>
+#include <math.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+#include <fftw3.h>
+
+#include "common.h"
+
+/*
+ * Running SNR estimate
+ *
+ * Three band-pass filters, each a cascade of identical biquads, follow the
+ * power in a noise-only band below the video (500 Hz), the video band itself
+ * (1900 Hz) and a noise-only band above it (3200 Hz). Each output power goes
+ * through a slow moving average. The noise filters are narrow and sit inside
+ * the 400-800 and 2700-3400 Hz noise bands of the FFT estimate, away from the
+ * video, so that video energy doesn't leak into the noise estimate.
+ *
+ * Eq. 15 is then evaluated with bandwidths in Hz: each filter's equivalent
+ * noise bandwidth takes the place of the bin counts.
+ *
+ */
+
+static const double SNRCenter[3] = {  500, 1900, 3200 };
+static const double SNRWidth[3]  = {  200, 1600,  200 };
+
+#define SNR_RECEIVERBW 3000.0       // 400..3400 Hz
+#define SNR_AVGTIME    (4096 / 44100.0)   // seconds
+
+// Design the filters for Rate around HedrShift and clear all state
+void initSNR(SNREstimator *e, double Rate, int HedrShift) {
+
+  int    b, s, f;
+  double w0, w, alpha, a0, re, im, num, den, h2;
+
+  e->AvgLen = SNR_AVGTIME * Rate;
+
+  for (b = 0; b < 3; b++) {
+
+    // RBJ band-pass, 0 dB peak gain
+    w0    = 2 * M_PI * (SNRCenter[b] + HedrShift) / Rate;
+    alpha = sin(w0) / (2 * (SNRCenter[b] + HedrShift) / SNRWidth[b]);
+    a0    = 1 + alpha;
+
+    e->B0[b] =  alpha / a0;
+    e->A1[b] = -2 * cos(w0) / a0;
+    e->A2[b] = (1 - alpha) / a0;
+
+    for (s = 0; s < SNR_STAGES; s++) e->Z[b][s][0] = e->Z[b][s][1] = 0;
+    e->Power[b] = 0;
+
+    // Equivalent noise bandwidth of the cascade, in 1 Hz steps
+    e->ENBW[b] = 0;
+    for (f = 0; f < Rate / 2; f++) {
+      w   = 2 * M_PI * f / Rate;
+      // |b0 (1 - e^-2jw)|^2 / |1 + a1 e^-jw + a2 e^-2jw|^2
+      num = pow(e->B0[b], 2) * (2 - 2 * cos(2 * w));
+      re  = 1 + e->A1[b] * cos(w) + e->A2[b] * cos(2 * w);
+      im  =   - e->A1[b] * sin(w) - e->A2[b] * sin(2 * w);
+      den = re * re + im * im;
+      h2  = num / den;
+      e->ENBW[b] += pow(h2, SNR_STAGES);
+    }
+  }
+}
+
+// Feed one sample
+void updateSNR(SNREstimator *e, gint16 sample) {
+
+  int    b, s;
+  double x, y;
+
+  for (b = 0; b < 3; b++) {
+    x = sample / 32768.0;
+    for (s = 0; s < SNR_STAGES; s++) {
+      // Transposed direct form II; b1 = 0 and b2 = -b0 for a band-pass
+      y             = e->B0[b] * x + e->Z[b][s][0];
+      e->Z[b][s][0] = e->Z[b][s][1] - e->A1[b] * y;
+      e->Z[b][s][1] = -e->B0[b] * x - e->A2[b] * y;
+      x             = y;
+    }
+    e->Power[b] += (x * x - e->Power[b]) / e->AvgLen;
+  }
+}
+
+// Signal-to-noise ratio in dB, from -20 up
+double getSNR(SNREstimator *e) {
+
+  double Pnoise_density, Pnoise, Psignal;
+
+  Pnoise_density = (e->Power[0] + e->Power[2]) / (e->ENBW[0] + e->ENBW[2]);
+
+  // Eq 15
+  Pnoise  = Pnoise_density * SNR_RECEIVERBW;
+  Psignal = e->Power[1] - Pnoise_density * e->ENBW[1];
+
+  // Lower bound to -20 dB
+  return ((Pnoise <= 0 || Psignal / Pnoise < .01) ? -20 : 10 * log10(Psignal / Pnoise));
+}
@@ -1,72 +1,512 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <fftw3.h>
-#include <gtk/gtk.h>
-#include <alsa/asoundlib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include "common.h"
 
-/* Find the slant angle of the sync singnal and adjust sample rate to cancel it out
- *   Length:  number of PCM samples to process
- *   Mode:    one of M1, M2, S1, S2, R72, R36 ...
- *   Rate:    approximate sampling rate used
- *   Skip:    pointer to variable where the skip amount will be returned
- *   returns  adjusted sample rate
+/*
+ * Linear Hough transform of the sync image
  *
+ * Only the sync pixels, a few per line, are listed and voted with. Each
+ * angle has its own row of line accumulators, so the angles are shared out
+ * to threads and every thread keeps just one row. sin and cos come from
+ * tables in 16.16 fixed point.
+ *
+ * A first pass tries every 2° and counts the votes within 8 pixels of each
+ * line distance, which a sync line a degree off still mostly stays inside;
+ * the second looks at every half degree around the best of those. A window
+ * that wide also lets angles further off than one coarse step gather as
+ * many votes as the right one, as long as the line stays inside it for the
+ * height of the picture, so the second pass reaches that far on both sides.
+ * When several angles tie, the one in the middle wins.
+ *
+ */
+
+#define HOUGH_ANGLES   ((MAXSLANT-MINSLANT)*2)   // in half degrees
+#define HOUGH_COARSE   4                         // half degrees between coarse angles
+#define HOUGH_WINDOW   8                         // pixels of line distance per coarse vote
+#define HOUGH_THREADS  8
+
+#define FIT_GAP        2                         // missing decisions a sync pulse can have
+#define TRACK_DRIFT    1e-3                      // rate error left once a chain has 4 pulses
+#define TRACK_SHIFT    50                        // Hz a pulse can be off the tracked shift
+
+typedef struct {
+  gushort *Points;                  // x,y pairs
+  int      NumPoints;
+  int      LineWidth;
+  int      qFrom, qTo, qStep;       // half degrees, from MINSLANT*2
+  int      Window;                  // line distances counted together
+  int     *Votes, *Dist;            // best line per angle, by q - MINSLANT*2
+} HoughJob;
+
+static gint32         SinTab[HOUGH_ANGLES], CosTab[HOUGH_ANGLES];
+static pthread_once_t TrigOnce = PTHREAD_ONCE_INIT;
+
+static void makeTrig () {
+  int q;
+  for (q = MINSLANT*2; q < MAXSLANT*2; q++) {
+    SinTab[q-MINSLANT*2] = round(sin(deg2rad(q/2.0)) * 65536);
+    CosTab[q-MINSLANT*2] = round(cos(deg2rad(q/2.0)) * 65536);
+  }
+}
+
+static void *houghWorker (void *arg) {
+
+  HoughJob *job = arg;
+  int       i, q, d, a, Votes;
+  guint     Acc[700];
+  gint32    Sin, Cos;
+
+  for (q = job->qFrom; q < job->qTo; q += job->qStep) {
+
+    memset(Acc, 0, sizeof(Acc[0]) * job->LineWidth);
+    Sin = SinTab[q - MINSLANT*2];
+    Cos = CosTab[q - MINSLANT*2];
+
+    for (i = 0; i < job->NumPoints; i++) {
+      // LineWidth + round(-x sin + y cos)
+      d = (job->LineWidth * 65536 - job->Points[2*i] * Sin + job->Points[2*i+1] * Cos + 32768) >> 16;
+      if (d > 0 && d < job->LineWidth) Acc[d] ++;
+    }
+
+    a = q - MINSLANT*2;
+    job->Votes[a] = Votes = 0;
+    for (d = 0; d < job->LineWidth; d++) {
+      Votes += Acc[d];
+      if (d >= job->Window) Votes -= Acc[d - job->Window];
+      if (Votes > job->Votes[a]) {
+        job->Votes[a] = Votes;
+        job->Dist[a]  = d - job->Window / 2;
+      }
+    }
+  }
+
+  return NULL;
+}
+
+/* Best line through Points, over angles qFrom..qTo-1 every qStep half degrees
+ *   returns  number of votes for it, 0 if there are no lines at all
+ */
+static int hough (gushort *Points, int NumPoints, int LineWidth, int qFrom, int qTo, int qStep,
+    int Window, int *dMost, int *qMost) {
+
+  HoughJob   job[HOUGH_THREADS];
+  pthread_t  tid[HOUGH_THREADS];
+  gboolean   Threaded[HOUGH_THREADS];
+  int        Votes[HOUGH_ANGLES], Dist[HOUGH_ANGLES];
+  int        i, q, NumThreads, NumAngles = (qTo - qFrom + qStep - 1) / qStep, Most = 0, Tied = 0;
+  double     qMid = 0;
+
+  NumThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (NumThreads > HOUGH_THREADS) NumThreads = HOUGH_THREADS;
+  if (NumThreads > NumAngles)     NumThreads = NumAngles;
+  if (NumThreads < 1)             NumThreads = 1;
+
+  // Interleaved, so that every thread gets about as many angles
+  for (i = 0; i < NumThreads; i++) {
+    job[i].Points    = Points;
+    job[i].NumPoints = NumPoints;
+    job[i].LineWidth = LineWidth;
+    job[i].qFrom     = qFrom + i * qStep;
+    job[i].qTo       = qTo;
+    job[i].qStep     = qStep * NumThreads;
+    job[i].Window    = Window;
+    job[i].Votes     = Votes;
+    job[i].Dist      = Dist;
+    Threaded[i] = (i > 0 && pthread_create(&tid[i], NULL, houghWorker, &job[i]) == 0);
+  }
+
+  // This thread does the first share, and any that couldn't get a thread
+  for (i = 0; i < NumThreads; i++)
+    if (!Threaded[i]) houghWorker(&job[i]);
+  for (i = 0; i < NumThreads; i++)
+    if (Threaded[i]) pthread_join(tid[i], NULL);
+
+  // Most votes, and the middle one of the angles that got as many
+  for (q = qFrom; q < qTo; q += qStep) {
+    if (Votes[q - MINSLANT*2] > Most) {
+      Most = Votes[q - MINSLANT*2];
+      qMid = Tied = 0;
+    }
+    if (Votes[q - MINSLANT*2] == Most) {
+      qMid += q;
+      Tied ++;
+    }
+  }
+  if (Most == 0) return 0;
+  qMid /= Tied;
+
+  *qMost = 0;
+  for (q = qFrom; q < qTo; q += qStep) {
+    if (Votes[q - MINSLANT*2] == Most && (*qMost == 0 || fabs(q - qMid) < fabs(*qMost - qMid))) {
+      *qMost = q;
+      *dMost = Dist[q - MINSLANT*2];
+    }
+  }
+
+  return Most;
+}
+
+static int compareDouble (const void *a, const void *b) {
+  return (*(double*)a > *(double*)b) - (*(double*)a < *(double*)b);
+}
+
+// Median of the n values in x, which get sorted
+static double median (double *x, int n) {
+  qsort(x, n, sizeof(double), compareDouble);
+  return (n % 2 ? x[n/2] : (x[n/2 - 1] + x[n/2]) / 2);
+}
+
+/* Falling edge of pulses starting at Start samples into the line, in the first
+ * half of the line like the Hough path, minus the pulse length
+ */
+static double lineEdge (guchar Mode, double Rate, double Start) {
+
+  double Slope = ModeSpec[Mode].LineTime * Rate, Edge;
+
+  Edge = fmod(Start + ModeSpec[Mode].SyncTime * Rate, Slope);
+  if (Edge < 0)         Edge += Slope;
+  if (Edge > Slope / 2) Edge -= Slope / 2;
+
+  return Edge / Rate - ModeSpec[Mode].SyncTime;
+}
+
+/* Fit a line through the matched filter's sync pulses, one per line,
+ * starting from the line rate found by the Hough transform
+ *   Rate:    refined in place
+ *   Start:   where in the line the pulses start, in samples
+ *   returns  number of pulses on the line, 0 if too few to go by
+ */
+static int fitPulses (Decoder *d, guchar Mode, double *Rate, double *Start) {
+
+  int    i, Pass, Used = 0;
+  double P = ModeSpec[Mode].LineTime * *Rate, a, b = P, n, r, Tol;
+  double re = 0, im = 0, Sn, St, Snn, Snt, det;
+
+  if (d->NumSyncPulses < 8) return 0;
+
+  // Most common position within the line, by circular mean
+  for (i = 0; i < d->NumSyncPulses; i++) {
+    re += cos(2 * M_PI * d->SyncPulse[i] / P);
+    im += sin(2 * M_PI * d->SyncPulse[i] / P);
+  }
+  a = atan2(im, re) / (2 * M_PI) * P;
+
+  // Least squares t = a + n b over the pulses close enough to the last line
+  for (Pass = 0; Pass < 3; Pass++) {
+
+    Tol  = ModeSpec[Mode].SyncTime * *Rate / (Pass == 0 ? 2 : 8);
+    Used = 0;
+    Sn = St = Snn = Snt = 0;
+
+    for (i = 0; i < d->NumSyncPulses; i++) {
+      n = round((d->SyncPulse[i] - a) / b);
+      r = d->SyncPulse[i] - (a + n * b);
+      if (fabs(r) > Tol) continue;
+      Sn  += n;
+      St  += d->SyncPulse[i];
+      Snn += n * n;
+      Snt += n * d->SyncPulse[i];
+      Used ++;
+    }
+
+    det = Used * Snn - Sn * Sn;
+    if (Used < 8 || Used < ModeSpec[Mode].NumLines / 4 || det <= 0) return 0;
+
+    b = (Used * Snt - Sn * St) / det;
+    a = (St - b * Sn) / Used;
+  }
+
+  // Shouldn't be far from what the Hough transform said
+  if (fabs(b / P - 1) > 1e-3) return 0;
+
+  *Rate  = b / ModeSpec[Mode].LineTime;
+  *Start = fmod(a, b);
+  if (*Start < 0) *Start += b;
+
+  return Used;
+}
+
+/* Line through the sync pulses by Theil's abbreviated method: pulses are
+ * runs of sync decisions about a pulse long, chained into lines by their
+ * spacing; the rate is the median slope between the pulses of the first and
+ * second halves of the longest chain. One pass, no sync image, no retries.
+ *   Rate:    approximate on entry, fitted on return
+ *   s:       falling edge of the sync pulse within the line, in seconds,
+ *            minus the pulse length (what the Hough path finds)
+ *   returns  FALSE if there aren't enough pulses in line to go by
  */
-double FindSync (guchar Mode, double Rate, int *Skip) {
+static gboolean fitSlant (Decoder *d, guchar Mode, double *Rate, double *s) {
 
   int      LineWidth = ModeSpec[Mode].LineTime / ModeSpec[Mode].SyncTime * 4;
-  int      x,y;
-  int      q, d, qMost, dMost;
-  gushort  xAcc[700] = {0};
-  gushort  lines[600][(MAXSLANT-MINSLANT)*2];
-  gushort  cy, cx, Retries = 0;
-  gboolean SyncImg[700][630] = {{FALSE}};
-  double   t=0, slantAngle, s;
-  double   ConvoFilter[8] = { 1,1,1,1,-1,-1,-1,-1 };
-  double   convd, maxconvd=0;
-  int      xmax=0;
+  int      MaxPulses = ModeSpec[Mode].NumLines * 4 + 64, NumPulses = 0;
+  int      ChainLast[FIT_CHAINS], ChainLen[FIT_CHAINS], NumChains = 0, Best = 0;
+  int      n, k, c, i, Start, End, Used, Half;
+  int     *Line, *Chain;
+  double   P        = ModeSpec[Mode].LineTime * *Rate;       // samples per line
+  double   PulseLen = ModeSpec[Mode].SyncTime * *Rate;       // samples per pulse
+  double   MaxDrift = tan(deg2rad(90 - MINSLANT)) / LineWidth;
+  double  *t, *tt, *ll, x, Slope;
+  gboolean Fitted = FALSE;
+
+  t     = malloc(sizeof(double) * MaxPulses * 3);
+  Line  = malloc(sizeof(int) * MaxPulses * 2);
+  if (t == NULL || Line == NULL) {
+    perror("fitSlant: Unable to allocate memory for sync pulses");
+    exit(EXIT_FAILURE);
+  }
+  tt    = t + MaxPulses;
+  ll    = tt + MaxPulses;
+  Chain = Line + MaxPulses;
+
+  // Pulse starts, from the middle of each run of sync decisions, bridging
+  // short dropouts; the soft levels place its edges between decisions
+  for (n = nextSync(d, 0); n < d->SyncLen && NumPulses < MaxPulses; n = nextSync(d, n + 1)) {
+    for (Start = End = n; n < d->SyncLen && n <= End + FIT_GAP + 1; n++)
+      if (getSync(d, n)) End = n;
+    n = End;
+    if (End - Start + 1 < PulseLen / d->SyncHop / 2 || End - Start + 1 > PulseLen / d->SyncHop * 1.5 + 5) continue;
+    x = (Start - 1 + getSyncEdge(d, Start - 1) + End + getSyncEdge(d, End)) / 2;
+    t[NumPulses++] = x * d->SyncHop - PulseLen / 2;
+  }
+
+  // Chain each pulse to the first one whose last pulse is a whole number of
+  // lines back, allowing for the largest slant the Hough transform would
+  for (i = 0; i < NumPulses; i++) {
+    Chain[i] = -1;
+    for (c = 0; c < NumChains; c++) {
+      x = (t[i] - t[ChainLast[c]]) / P;
+      k = round(x);
+      if (k > 0 && fabs(x - k) * P < PulseLen / 2 + MaxDrift * k * P) {
+        Chain[i]      = c;
+        Line[i]       = Line[ChainLast[c]] + k;
+        ChainLast[c]  = i;
+        ChainLen[c]  ++;
+        break;
+      }
+    }
+    if (Chain[i] < 0 && NumChains < FIT_CHAINS) {
+      c             = NumChains++;
+      Chain[i]      = c;
+      Line[i]       = 0;
+      ChainLast[c]  = i;
+      ChainLen[c]   = 1;
+    }
+  }
+  for (c = 1; c < NumChains; c++)
+    if (ChainLen[c] > ChainLen[Best]) Best = c;
+
+  if (NumChains > 0 && ChainLen[Best] >= 8 && ChainLen[Best] >= ModeSpec[Mode].NumLines / 4) {
+
+    Used = 0;
+    for (i = 0; i < NumPulses; i++) {
+      if (Chain[i] != Best) continue;
+      tt[Used] = t[i];
+      ll[Used] = Line[i];
+      Used ++;
+    }
+
+    // Median slope between pulse i and pulse i + Half
+    Half = (Used + 1) / 2;
+    for (i = 0; i + Half < Used; i++)
+      t[i] = (tt[i + Half] - tt[i]) / (ll[i + Half] - ll[i]);
+    Slope = median(t, Used - Half);
+
+    // Median intercept
+    for (i = 0; i < Used; i++) t[i] = tt[i] - Slope * ll[i];
+    x = median(t, Used);
+
+    printf("    line fit on %d pulses: %.2f Hz\n", Used, Slope / ModeSpec[Mode].LineTime);
+
+    if (fabs(Slope / P - 1) < MaxDrift) {
+
+      *Rate = Slope / ModeSpec[Mode].LineTime;
+      *s    = lineEdge(Mode, *Rate, x);
+
+      Fitted = TRUE;
+    }
+  }
+
+  free(t);
+  free(Line);
+
+  return Fitted;
+}
+
+/*
+ * Running line fit
+ *
+ * GetVideo() hands every pulse from the matched filter to trackSlant() as
+ * it comes. Pulses are chained into lines like fitSlant() does, only each
+ * chain keeps least squares sums instead of its pulses, and once it has a
+ * few of them the next pulse is looked for where its own line says. The
+ * longest chain is the sync; by the last line FindSync() only has to read
+ * off its line.
+ *
+ * The frequencies of the pulses on that chain also follow HedrShift.
+ *
+ */
+
+// t = a + n b through the pulses of a chain
+static void chainFit (PulseChain *c, double P, double *a, double *b) {
+
+  double det = c->Len * c->Snn - c->Sn * c->Sn;
+
+  *b = (det > 0 ? (c->Len * c->Snt - c->Sn * c->St) / det : P);
+  *a = c->t0 + (c->St - *b * c->Sn) / c->Len;
+}
+
+/* Forget all pulses; start from Rate and a HedrShift of Shift Hz
+ */
+void initSlantTracker (Decoder *d, guchar Mode, double Rate, double Shift) {
+
+  int LineWidth = ModeSpec[Mode].LineTime / ModeSpec[Mode].SyncTime * 4;
+
+  d->Track.Mode      = Mode;
+  d->Track.P         = ModeSpec[Mode].LineTime * Rate;
+  d->Track.PulseLen  = ModeSpec[Mode].SyncTime * Rate;
+  d->Track.MaxDrift  = tan(deg2rad(90 - MINSLANT)) / LineWidth;
+  d->Track.Shift     = Shift;
+  d->Track.Done      = 0;
+  d->Track.NumChains = 0;
+  d->Track.Best      = 0;
+}
+
+// Take in the pulses found since the last call
+void trackSlant (Decoder *d) {
+
+  int         c, k;
+  double      t, a, b, x, Drift, Offset;
+  PulseChain *ch = NULL;
+
+  for (; d->Track.Done < d->NumSyncPulses; d->Track.Done++) {
+
+    t = d->SyncPulse[d->Track.Done];
+
+    // First chain whose last pulse is a whole number of lines back
+    for (c = 0; c < d->Track.NumChains; c++) {
+      ch = &d->Track.Chain[c];
+      if (ch->Len >= 4) {
+        chainFit(ch, d->Track.P, &a, &b);
+        Drift = TRACK_DRIFT;
+      } else {
+        b     = d->Track.P;
+        Drift = d->Track.MaxDrift;
+      }
+      x = (t - ch->LastT) / b;
+      k = round(x);
+      if (k > 0 && fabs(x - k) * b < d->Track.PulseLen / 2 + Drift * k * b) break;
+    }
+
+    if (c == d->Track.NumChains) {
+      if (d->Track.NumChains == FIT_CHAINS) continue;
+      ch = &d->Track.Chain[d->Track.NumChains++];
+      memset(ch, 0, sizeof(PulseChain));
+      ch->t0       = t;
+      ch->LastLine = k = 0;
+    } else {
+      k += ch->LastLine;
+    }
+
+    ch->Len ++;
+    ch->Sn      += k;
+    ch->St      += t - ch->t0;
+    ch->Snn     += (double)k * k;
+    ch->Snt     += k * (t - ch->t0);
+    ch->LastT    = t;
+    ch->LastLine = k;
+
+    if (ch->Len > d->Track.Chain[d->Track.Best].Len) d->Track.Best = c;
+
+    // Follow the frequency of the sync, leaving out strays
+    Offset = d->SyncPulseFreq[d->Track.Done] - 1200;
+    if (c == d->Track.Best && ch->Len >= 4 && fabs(Offset - d->Track.Shift) < TRACK_SHIFT)
+      d->Track.Shift += (Offset - d->Track.Shift) / 8;
+  }
+}
+
+// HedrShift as followed on the sync pulses so far
+double getTrackedShift (Decoder *d) {
+  return d->Track.Shift;
+}
+
+/* Slant from the running fit, if its longest chain is long enough to go by
+ *   Rate:    fitted on return
+ *   s:       as for fitSlant()
+ */
+static gboolean trackedSlant (Decoder *d, guchar Mode, double *Rate, double *s) {
+
+  PulseChain *ch = &d->Track.Chain[d->Track.Best];
+  double      a, b;
+
+  if (d->Track.Mode != Mode || d->Track.NumChains == 0 || ch->Len < 8 ||
+      ch->Len < ModeSpec[Mode].NumLines / 4) return FALSE;
+
+  chainFit(ch, d->Track.P, &a, &b);
+
+  printf("    running fit on %d pulses: %.2f Hz\n", ch->Len, b / ModeSpec[Mode].LineTime);
+
+  if (fabs(b / d->Track.P - 1) >= d->Track.MaxDrift) return FALSE;
+
+  *Rate = b / ModeSpec[Mode].LineTime;
+  *s    = lineEdge(Mode, *Rate, a);
+
+  return TRUE;
+}
+
+/* Iterate the Hough transform until the slant is gone
+ *   Rate:    adjusted in place; the decoder's own if it can't be fixed
+ *   returns  TRUE if the slant is within half a degree
+ */
+static gboolean houghSlant (Decoder *d, guchar Mode, double *Rate) {
+
+  int      LineWidth = ModeSpec[Mode].LineTime / ModeSpec[Mode].SyncTime * 4;
+  int      x, y, qMost, dMost, NumPoints, Reach;
+  gushort  Retries = 0;
+  gushort *Points;
+  gboolean SlantOK = FALSE;
+  double   t, slantAngle;
+
+  pthread_once(&TrigOnce, makeTrig);
+
+  // Half degrees around the coarse peak where the right angle can be: a
+  // coarse step, and as far as a line can tilt and stay in the window
+  Reach = HOUGH_COARSE + ceil(2 * rad2deg(asin(MIN(1.0, (double)HOUGH_WINDOW / ModeSpec[Mode].NumLines))));
+
+  Points = malloc(sizeof(gushort) * 2 * LineWidth * ModeSpec[Mode].NumLines);
+  if (Points == NULL) {
+    perror("FindSync: Unable to allocate memory for sync image");
+    exit(EXIT_FAILURE);
+  }
 
   // Repeat until slant < 0.5° or until we give up
   while (TRUE) {
 
-    // Draw the 2D sync signal at current rate
-    
+    // List the sync pixels of the 2D sync signal at current rate
+    NumPoints = 0;
     for (y=0; y<ModeSpec[Mode].NumLines; y++) {
       for (x=0; x<LineWidth; x++) {
         t = (y + 1.0*x/LineWidth) * ModeSpec[Mode].LineTime;
-        SyncImg[x][y] = HasSync[ (int)( t * Rate / 13.0) ];
+        if (getSync(d, (int)( t * *Rate / d->SyncHop) )) {
+          Points[2*NumPoints]   = x;
+          Points[2*NumPoints+1] = y;
+          NumPoints ++;
+        }
       }
     }
 
-    /** Linear Hough transform **/
+    /** Linear Hough transform, coarse to fine **/
 
     dMost = qMost = 0;
-    memset(lines, 0, sizeof(lines[0][0]) * (MAXSLANT-MINSLANT)*2 * 600);
-
-    // Find white pixels
-    for (cy = 0; cy < ModeSpec[Mode].NumLines; cy++) {
-      for (cx = 0; cx < LineWidth; cx++) {
-        if (SyncImg[cx][cy]) {
-
-          // Slant angles to consider
-          for (q = MINSLANT*2; q < MAXSLANT*2; q ++) {
-
-            // Line accumulator
-            d = LineWidth + round( -cx * sin(deg2rad(q/2.0)) + cy * cos(deg2rad(q/2.0)) );
-            if (d > 0 && d < LineWidth) {
-              lines[d][q-MINSLANT*2] ++;
-              if (lines[d][q-MINSLANT*2] > lines[dMost][qMost-MINSLANT*2]) {
-                dMost = d;
-                qMost = q;
-              }
-            }
-          }
-        }
-      }
-    }
+    if (hough(Points, NumPoints, LineWidth, MINSLANT*2, MAXSLANT*2, HOUGH_COARSE, HOUGH_WINDOW, &dMost, &qMost) > 0)
+      hough(Points, NumPoints, LineWidth, MAX(qMost - Reach, MINSLANT*2),
+          MIN(qMost + Reach + 1, MAXSLANT*2), 1, 1, &dMost, &qMost);
 
     if ( qMost == 0) {
       printf("    no sync signal; giving up\n");
@@ -75,30 +515,46 @@ double FindSync (guchar Mode, double Rate, int *Skip) {
 
     slantAngle = qMost / 2.0;
 
-    printf("    %.1f° (d=%d) @ %.1f Hz", slantAngle, dMost, Rate);
+    printf("    %.1f° (d=%d) @ %.1f Hz", slantAngle, dMost, *Rate);
 
     // Adjust sample rate
-    Rate += tan(deg2rad(90 - slantAngle)) / LineWidth * Rate;
+    *Rate += tan(deg2rad(90 - slantAngle)) / LineWidth * *Rate;
 
     if (slantAngle > 89 && slantAngle < 91) {
       printf("            slant OK :)\n");
+      SlantOK = TRUE;
       break;
     } else if (Retries == 3) {
       printf("            still slanted; giving up\n");
-      Rate = 44100;
-      printf("    -> 44100\n");
+      *Rate = d->SampleRate;
+      printf("    -> %.1f\n", *Rate);
       break;
     }
-    printf(" -> %.1f    recalculating\n", Rate);
+    printf(" -> %.1f    recalculating\n", *Rate);
     Retries ++;
   }
-  
-  // accumulate a 1-dim array of the position of the sync pulse
-  memset(xAcc, 0, sizeof(xAcc[0]) * 700);
+
+  free(Points);
+
+  return SlantOK;
+}
+
+/* Falling edge of the sync pulse within the line, from all lines stacked up,
+ * minus the pulse length
+ */
+static double syncEdge (Decoder *d, guchar Mode, double Rate) {
+
+  int      x, y, xmax = 0;
+  guint    xAcc[700] = {0};
+  double   t, convd, maxconvd = 0;
+  double   ConvoFilter[8] = { 1,1,1,1,-1,-1,-1,-1 };
+
+  // accumulate a 1-dim array of the position of the sync pulse, weighted
+  // by sync strength when there's a soft track
   for (y=0; y<ModeSpec[Mode].NumLines; y++) {
     for (x=0; x<700; x++) { 
       t = y * ModeSpec[Mode].LineTime + x/700.0 * ModeSpec[Mode].LineTime;
-      xAcc[x] += HasSync[ (int)(t / (13.0/44100) * Rate/44100) ];
+      xAcc[x] += getSyncLevel(d, (int)(t * Rate / d->SyncHop) );
     }
   }
 
@@ -116,8 +572,49 @@ double FindSync (guchar Mode, double Rate, int *Skip) {
   // out the left edge
   if (xmax > 350) xmax -= 350;
 
+  return xmax / 700.0 * ModeSpec[Mode].LineTime - ModeSpec[Mode].SyncTime;
+}
+
+/* Find the slant angle of the sync singnal and adjust sample rate to cancel it out
+ *   Length:  number of PCM samples to process
+ *   Mode:    one of M1, M2, S1, S2, R72, R36 ...
+ *   Rate:    approximate sampling rate used
+ *   Skip:    pointer to variable where the skip amount will be returned
+ *   returns  adjusted sample rate
+ *
+ */
+double FindSync (Decoder *d, guchar Mode, double Rate, int *Skip) {
+
+  gboolean SlantOK = FALSE, Fitted = FALSE;
+  double   s = 0, PulseStart = 0;
+  int      Pulses = 0, Method = d->Options.SlantMethod, Used = -1;
+
+  // The running fit of the pulses during reception falls back to the line
+  // fit, and that to the Hough transform, when it finds no line
+  if (Method == SLANT_TRACK && trackedSlant(d, Mode, &Rate, &s))               Used = SLANT_TRACK;
+  if (Used < 0 && Method >= SLANT_FIT && fitSlant(d, Mode, &Rate, &s))         Used = SLANT_FIT;
+  if (Used < 0 && houghSlant(d, Mode, &Rate))                                   Used = SLANT_HOUGH;
+
+  Fitted  = (Used == SLANT_TRACK || Used == SLANT_FIT);
+  SlantOK = (Used >= 0);
+  d->CurrentPic.SlantUsed = Used;
+  printf("    slant from %s\n", (Used >= 0 ? SlantNames[Used] : "nowhere"));
+
+  // The matched filter timed the pulses to a fraction of a sample; fine-tune
+  // on those once the slant is about right
+  if (Fitted || SlantOK) {
+    Pulses = fitPulses(d, Mode, &Rate, &PulseStart);
+    if (Pulses > 0) printf("    %d sync pulses -> %.2f Hz\n", Pulses, Rate);
+  }
+
   // Skip until the start of the line
-  s = xmax / 700.0 * ModeSpec[Mode].LineTime - ModeSpec[Mode].SyncTime;
+  if (!Fitted) s = syncEdge(d, Mode, Rate);
+
+  // Same place from the pulses, give or take the half lines above
+  if (Pulses > 0) {
+    PulseStart /= Rate;
+    s = PulseStart + round((s - PulseStart) / (ModeSpec[Mode].LineTime / 2)) * ModeSpec[Mode].LineTime / 2;
+  }
   
   // (Scottie modes don't start lines with sync)
   if (Mode == S1 || Mode == S2 || Mode == SDX)
@@ -2,143 +2,386 @@
 #include <stdio.h>
 #include <math.h>
 #include <string.h>
-#include <gtk/gtk.h>
-#include <alsa/asoundlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include <fftw3.h>
 
 #include "common.h"
 
-/* Demodulate the video signal & store all kinds of stuff for later stages
- *  Mode:      M1, M2, S1, S2, R72, R36...
- *  Rate:      exact sampling rate used
- *  Skip:      number of PCM samples to skip at the beginning (for sync phase adjustment)
- *  Redraw:    FALSE = Apply windowing and FFT to the signal, TRUE = Redraw from cached FFT data
- *  returns:   TRUE when finished, FALSE when aborted
+#define REDRAW_THREADS 16   // most threads a redraw is split between
+
+// Hann window for the given SNR
+static guchar WinIdxForSNR(double SNR) {
+  if      (SNR >=  20) return 0;
+  else if (SNR >=  10) return 1;
+  else if (SNR >=   9) return 2;
+  else if (SNR >=   3) return 3;
+  else if (SNR >=  -5) return 4;
+  else if (SNR >= -10) return 5;
+  else                 return 6;
+}
+
+// Luminance at a time between the first Stored values of StoredLum
+static double lumAt(Decoder *d, double Time, int Stored) {
+  double k = Time / d->LumHop;
+  int    i = floor(k);
+
+  if (i < 0)           return d->StoredLum[0] / (double)LUM_ONE;
+  if (i >= Stored - 1) return d->StoredLum[Stored-1] / (double)LUM_ONE;
+
+  return (d->StoredLum[i] + (k - i) * (d->StoredLum[i+1] - d->StoredLum[i])) / LUM_ONE;
+}
+
+/*
+ * Pixel schedule
+ *
+ * Pixels are taken out of the stored luminance in the order they were sent,
+ * each at the sample time its mode's line layout puts it. The layouts only
+ * differ in how many channels a line has and whether the second one
+ * alternates between R-Y and B-Y, so a stepper for each is made from the
+ * same inline template with those as constants.
+ *
  */
-gboolean GetVideo(guchar Mode, double Rate, int Skip, gboolean Redraw) {
 
-  guint      MaxBin = 0;
-  guint      VideoPlusNoiseBins=0, ReceiverBins=0, NoiseOnlyBins=0;
-  guint      n=0;
-  guint      SyncSampleNum;
-  guint      i=0, j=0;
-  guint      FFTLen=1024, WinLength=0;
-  guint      SyncTargetBin;
-  int        SampleNum, Length, NumChans;
-  int        x = 0, y = 0, tx=0, k=0;
-  double     Hann[7][1024] = {{0}};
-  double     Freq = 0, PrevFreq = 0, InterpFreq = 0;
-  int        NextSNRtime = 0, NextSyncTime = 0;
-  double     Praw, Psync;
-  double     Power[1024] = {0};
-  double     Pvideo_plus_noise=0, Pnoise_only=0, Pnoise=0, Psignal=0;
-  double     SNR = 0;
-  double     ChanStart[4] = {0}, ChanLen[4] = {0};
-  guchar     Image[800][616][3] = {{{0}}};
-  guchar     Channel = 0, WinIdx = 0;
+typedef struct _PixelSched PixelSched;
+struct _PixelSched {
+  int       X, Y, Chan;               // next pixel; Chan counts the channels sent on line Y
+  guchar    Channel;                  // image channel it goes to
+  gboolean  Tall;                     // and to line Y+1 as well
+  double    Time;                     // sample number, from the start of the picture
+  gboolean  Done;                     // past the last pixel
+
+  int       Width, NumLines, NumChans;
+  gboolean  Alternate;
+  double    Rate, Skip, LineTime;
+  double    ChanStart[3], ChanLen[3]; // in seconds from the start of the line
+  gboolean (*Next)(PixelSched *s);
+};
+
+// Sample number of column X, which needn't be whole, in channel Chan of line Y
+static inline double pixelTime(const PixelSched *s, double X) {
+  return s->Rate * (s->Y * s->LineTime + s->ChanStart[s->Chan] +
+      (X - .5) / s->Width * s->ChanLen[s->Channel]) + s->Skip;
+}
 
-  typedef struct {
-    int X;
-    int Y;
-    int Time;
-    guchar Channel;
-    gboolean Last;
-  } _PixelGrid;
+static inline void schedPlace(PixelSched *s, const gboolean Alternate) {
+  s->Channel = (Alternate && s->Chan == 1 && s->Y % 2 == 1 ? 2 : s->Chan);
+  s->Tall    = (Alternate && s->Chan > 0);
+  s->Time    = pixelTime(s, s->X);
+}
 
-  _PixelGrid *PixelGrid;
-  PixelGrid = calloc( ModeSpec[Mode].ImgWidth * ModeSpec[Mode].NumLines * 3, sizeof(_PixelGrid) );
+// Step to the next pixel of a layout with NumChans channels per line; FALSE past the last
+static inline gboolean schedStep(PixelSched *s, const int NumChans, const gboolean Alternate) {
+  if (++s->X == s->Width) {
+    s->X = 0;
+    if (++s->Chan == NumChans) {
+      s->Chan = 0;
+      if (++s->Y == s->NumLines) return FALSE;
+    }
+  }
+  schedPlace(s, Alternate);
+  return TRUE;
+}
 
+// Y only
+static gboolean nextBW    (PixelSched *s) { return schedStep(s, 1, FALSE); }
+// Y, then R-Y on even and B-Y on odd lines, each for two lines
+static gboolean nextRobot (PixelSched *s) { return schedStep(s, 2, TRUE);  }
+// Three channels in the order of ColorEnc
+static gboolean nextThree (PixelSched *s) { return schedStep(s, 3, FALSE); }
 
-  // Initialize Hann windows of different lengths
-  gushort HannLens[7] = { 48, 64, 96, 128, 256, 512, 1024 };
-  for (j = 0; j < 7; j++)
-    for (i = 0; i < HannLens[j]; i++)
-      Hann[j][i] = 0.5 * (1 - cos( (2 * M_PI * i) / (HannLens[j] - 1)) );
+// Lay out the lines of Mode and place the first pixel at or after sample 0
+static void initSched(PixelSched *s, guchar Mode, double Rate, int Skip) {
 
+  _ModeSpec  *m = &ModeSpec[Mode];
+
+  memset(s, 0, sizeof(PixelSched));
+  s->Width    = m->ImgWidth;
+  s->NumLines = m->NumLines;
+  s->Rate     = Rate;
+  s->Skip     = Skip;
+  s->LineTime = m->LineTime;
 
   // Starting times of video channels on every line, counted from beginning of line
   switch (Mode) {
 
     case R36:
     case R24:
-      ChanLen[0]   = ModeSpec[Mode].PixelTime * ModeSpec[Mode].ImgWidth * 2;
-      ChanLen[1]   = ChanLen[2] = ModeSpec[Mode].PixelTime * ModeSpec[Mode].ImgWidth;
-      ChanStart[0] = ModeSpec[Mode].SyncTime + ModeSpec[Mode].PorchTime;
-      ChanStart[1] = ChanStart[0] + ChanLen[0] + ModeSpec[Mode].SeptrTime;
-      ChanStart[2] = ChanStart[1];
+      s->ChanLen[0]   = m->PixelTime * m->ImgWidth * 2;
+      s->ChanLen[1]   = s->ChanLen[2] = m->PixelTime * m->ImgWidth;
+      s->ChanStart[0] = m->SyncTime + m->PorchTime;
+      s->ChanStart[1] = s->ChanStart[0] + s->ChanLen[0] + m->SeptrTime;
+      s->ChanStart[2] = s->ChanStart[1];
       break;
 
     case S1:
     case S2:
     case SDX:
-      ChanLen[0]   = ChanLen[1] = ChanLen[2] = ModeSpec[Mode].PixelTime * ModeSpec[Mode].ImgWidth;
-      ChanStart[0] = ModeSpec[Mode].SeptrTime;
-      ChanStart[1] = ChanStart[0] + ChanLen[0] + ModeSpec[Mode].SeptrTime;
-      ChanStart[2] = ChanStart[1] + ChanLen[1] + ModeSpec[Mode].SyncTime + ModeSpec[Mode].PorchTime;
+      s->ChanLen[0]   = s->ChanLen[1] = s->ChanLen[2] = m->PixelTime * m->ImgWidth;
+      s->ChanStart[0] = m->SeptrTime;
+      s->ChanStart[1] = s->ChanStart[0] + s->ChanLen[0] + m->SeptrTime;
+      s->ChanStart[2] = s->ChanStart[1] + s->ChanLen[1] + m->SyncTime + m->PorchTime;
       break;
 
     default:
-      ChanLen[0]   = ChanLen[1] = ChanLen[2] = ModeSpec[Mode].PixelTime * ModeSpec[Mode].ImgWidth;
-      ChanStart[0] = ModeSpec[Mode].SyncTime + ModeSpec[Mode].PorchTime;
-      ChanStart[1] = ChanStart[0] + ChanLen[0] + ModeSpec[Mode].SeptrTime;
-      ChanStart[2] = ChanStart[1] + ChanLen[1] + ModeSpec[Mode].SeptrTime;
+      s->ChanLen[0]   = s->ChanLen[1] = s->ChanLen[2] = m->PixelTime * m->ImgWidth;
+      s->ChanStart[0] = m->SyncTime + m->PorchTime;
+      s->ChanStart[1] = s->ChanStart[0] + s->ChanLen[0] + m->SeptrTime;
+      s->ChanStart[2] = s->ChanStart[1] + s->ChanLen[1] + m->SeptrTime;
       break;
 
   }
 
   // Number of channels per line
-  switch(Mode) {
+  switch (Mode) {
     case R24BW:
     case R12BW:
     case R8BW:
-      NumChans = 1;
+      s->Next     = nextBW;
+      s->NumChans = 1;
       break;
     case R24:
     case R36:
-      NumChans = 2;
+      s->Next      = nextRobot;
+      s->NumChans  = 2;
+      s->Alternate = TRUE;
       break;
     default:
-      NumChans = 3;
+      s->Next     = nextThree;
+      s->NumChans = 3;
       break;
   }
 
-  // Plan ahead the time instants (in samples) at which to take pixels out
-  int PixelIdx = 0;
-  for (y=0; y<ModeSpec[Mode].NumLines; y++) {
-    for (Channel=0; Channel<NumChans; Channel++) {
-      for (x=0; x<ModeSpec[Mode].ImgWidth; x++) {
-
-        if (Mode == R36 || Mode == R24) {
-          if (Channel == 1) {
-            if (y % 2 == 0) PixelGrid[PixelIdx].Channel = 1;
-            else            PixelGrid[PixelIdx].Channel = 2;
-          } else            PixelGrid[PixelIdx].Channel = 0;
-        } else {
-          PixelGrid[PixelIdx].Channel = Channel;
-        }
-        
-        PixelGrid[PixelIdx].Time = (int)round(Rate * (y * ModeSpec[Mode].LineTime + ChanStart[Channel] +
-          (1.0*(x-.5)/ModeSpec[Mode].ImgWidth*ChanLen[PixelGrid[PixelIdx].Channel]))) + Skip;
+  schedPlace(s, s->Alternate);
+  while (s->Time < 0 && !s->Done) s->Done = !s->Next(s);
+}
 
+// YUV to RGB in hundredths, all integer
+#define YUV_R(y,u,v) (100 * (y) + 140 * (u)            - 17850)
+#define YUV_G(y,u,v) (100 * (y) -  71 * (u) - 33 * (v) + 13260)
+#define YUV_B(y,u,v) (100 * (y)            + 178 * (v) - 22695)
 
-        PixelGrid[PixelIdx].X = x;
-        PixelGrid[PixelIdx].Y = y;
-        
+// Hundredths rounded and clipped to 0..255, as clip() would; n*5243 >> 19
+// is n/100 for n up to 43000
+static inline guchar sat100(int a) {
+  a = (a < 0 ? 0 : (a > 25500 ? 25500 : a));
+  return ((a + 50) * 5243) >> 19;
+}
+
+/* Convert a line of channels c0, c1, c2 to RGB in pixbuf row p
+ *
+ * The channels are planar and the loops have no branches to speak of, so
+ * that the compiler can vectorize them.
+ */
+static void paintLine(guchar *p, guchar ColorEnc, const guchar *c0, const guchar *c1, const guchar *c2, int Width) {
+
+  int x;
 
-        PixelGrid[PixelIdx].Last = FALSE;
+  switch(ColorEnc) {
 
-        PixelIdx ++;
+    case RGB:
+      for (x = 0; x < Width; x++) {
+        p[3*x]   = c0[x];
+        p[3*x+1] = c1[x];
+        p[3*x+2] = c2[x];
       }
-    }
-  }
-  PixelGrid[PixelIdx-1].Last = TRUE;
+      break;
 
-  for (k=0; k<PixelIdx; k++) {
-    if (PixelGrid[k].Time >= 0) {
-      PixelIdx = k;
+    case GBR:
+      for (x = 0; x < Width; x++) {
+        p[3*x]   = c2[x];
+        p[3*x+1] = c0[x];
+        p[3*x+2] = c1[x];
+      }
       break;
+
+    case YUV:
+      for (x = 0; x < Width; x++) {
+        p[3*x]   = sat100(YUV_R(c0[x], c1[x], c2[x]));
+        p[3*x+1] = sat100(YUV_G(c0[x], c1[x], c2[x]));
+        p[3*x+2] = sat100(YUV_B(c0[x], c1[x], c2[x]));
+      }
+      break;
+
+    case BW:
+      for (x = 0; x < Width; x++)
+        p[3*x] = p[3*x+1] = p[3*x+2] = c0[x];
+      break;
+
+  }
+}
+
+/*
+ * Redraw
+ *
+ * A picture redrawn at a corrected rate and skip has all its luminance
+ * stored already, so each line is worked out on its own straight from
+ * StoredLum, with the lines split between threads. A pixel gets what the
+ * first pass would have given it: Robot chroma comes from the latest even
+ * (R-Y) or odd (B-Y) line, and pixels outside the stored stretch stay black.
+ * Drawn smaller, for a preview, only the pixels shown are worked out.
+ *
+ */
+
+typedef struct _RedrawJob RedrawJob;
+struct _RedrawJob {
+  Decoder    *d;
+  PixelSched  Sched;          // layout; the position is ignored
+  guchar      ColorEnc;
+  int         Stored;         // values in StoredLum
+  double      LastTime;       // sample number of the last one
+  int         FirstLine, EndLine; // of the output
+  int         OutWidth, OutLines;
+  guchar     *pixels;
+  int         rowstride;
+};
+
+static void *redrawWorker(void *arg) {
+
+  RedrawJob  *j = arg;
+  PixelSched  s = j->Sched;
+  guchar     *Line;
+  double      Time;
+  int         u, v, y, c, W = j->OutWidth;
+
+  // Planar, one line of each channel
+  Line = malloc(3 * W);
+  if (Line == NULL) {
+    perror("redrawWorker: Unable to allocate memory for line");
+    exit(EXIT_FAILURE);
+  }
+
+  for (v = j->FirstLine; v < j->EndLine; v++) {
+
+    y = v * s.NumLines / j->OutLines;
+
+    memset(Line, 0, 3 * W);
+
+    for (c = 0; c < (s.Alternate ? 3 : s.NumChans); c++) {
+
+      // Which line and which of its channels this one was sent in
+      s.Chan    = (s.Alternate ? (c > 0) : c);
+      s.Channel = c;
+      s.Y       = (s.Alternate && c > 0 ? y - (y + c + 1) % 2 : y);
+      if (s.Y < 0) continue;
+
+      for (u = 0; u < W; u++) {
+        Time = pixelTime(&s, (u + .5) * s.Width / W - .5);
+        if (Time >= 0 && Time <= j->LastTime)
+          Line[c * W + u] = clip(lumAt(j->d, Time, j->Stored));
+      }
     }
+
+    paintLine(j->pixels + v * j->rowstride, j->ColorEnc, Line, Line + W, Line + 2 * W, W);
+  }
+
+  free(Line);
+
+  return NULL;
+}
+
+/* Draw the picture again from StoredLum at another rate and skip
+ *   dest:  CurrentPic.pixbuf, or a smaller RGB one
+ */
+void drawVideo(Decoder *d, guchar Mode, double Rate, int Skip, GdkPixbuf *dest) {
+
+  RedrawJob  job[REDRAW_THREADS];
+  pthread_t  tid[REDRAW_THREADS];
+  gboolean   Threaded[REDRAW_THREADS];
+  int        i, NumThreads, Length;
+
+  Length     = ModeSpec[Mode].LineTime * ModeSpec[Mode].NumLines * d->SampleRate;
+
+  NumThreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (NumThreads > REDRAW_THREADS)              NumThreads = REDRAW_THREADS;
+  if (NumThreads > gdk_pixbuf_get_height(dest)) NumThreads = gdk_pixbuf_get_height(dest);
+  if (NumThreads < 1)                           NumThreads = 1;
+
+  // A block of lines each
+  for (i = 0; i < NumThreads; i++) {
+    initSched(&job[i].Sched, Mode, Rate, Skip);
+    job[i].d         = d;
+    job[i].ColorEnc  = ModeSpec[Mode].ColorEnc;
+    job[i].Stored    = (Length - 1) / d->LumHop + 1;
+    job[i].LastTime  = Length - 1;
+    job[i].OutWidth  = gdk_pixbuf_get_width(dest);
+    job[i].OutLines  = gdk_pixbuf_get_height(dest);
+    job[i].FirstLine = job[i].OutLines *  i    / NumThreads;
+    job[i].EndLine   = job[i].OutLines * (i+1) / NumThreads;
+    job[i].pixels    = gdk_pixbuf_get_pixels(dest);
+    job[i].rowstride = gdk_pixbuf_get_rowstride(dest);
+    Threaded[i] = (i > 0 && pthread_create(&tid[i], NULL, redrawWorker, &job[i]) == 0);
+  }
+
+  // This thread does the first block, and any that couldn't get a thread
+  for (i = 0; i < NumThreads; i++)
+    if (!Threaded[i]) redrawWorker(&job[i]);
+  for (i = 0; i < NumThreads; i++)
+    if (Threaded[i]) pthread_join(tid[i], NULL);
+}
+
+/* Demodulate the video signal & store all kinds of stuff for later stages
+ *  Mode:      M1, M2, S1, S2, R72, R36...
+ *  Rate:      exact sampling rate used
+ *  Skip:      number of PCM samples to skip at the beginning (for sync phase adjustment)
+ *  Redraw:    FALSE = Apply windowing and FFT to the signal, TRUE = Redraw from cached FFT data
+ *  returns:   TRUE when finished, FALSE when aborted
+ */
+gboolean GetVideo(Decoder *d, guchar Mode, double Rate, int Skip, gboolean Redraw) {
+
+  if (Redraw) {
+    drawVideo(d, Mode, Rate, Skip, d->CurrentPic.pixbuf);
+    showImage(d, ModeSpec[Mode].NumLines - 1);
+    return TRUE;
+  }
+
+  guint      MaxBin = 0, LoBin, HiBin, MidBin;
+  guint      SyncSampleNum;
+  int        Stored = 1;
+  guint      i=0, j=0;
+  guint      FFTLen = scaleFFT(d, 1024), WinLength=0;
+  int        SampleNum, Length;
+  int        x = 0, y = 0;
+  int        Width = ModeSpec[Mode].ImgWidth, NumLines = ModeSpec[Mode].NumLines;
+  dsp_t      Hann[7][FFT_MAXLEN/2] = {{0}};
+  double     Freq = 0, Lum;
+  int        NextSNRtime = 0, NextSyncTime = 0;
+  int        FFTHop = d->LumHop, SNRHop = scaleLen(d, 256);
+  int        VUHop  = scaleLen(d, 8820) / FFTHop * FFTHop;
+  double     Praw, Psync;
+  dsp_t      Power[FFT_MAXLEN] = {0};
+  double     SNR = 0;
+  double     Shift = d->CurrentPic.HedrShift;
+  guchar    *Image;
+  guchar     Channel = 0, WinIdx = 0, SNRIdx = 0;
+  SlidingDFT sdft;
+  HilbertDemod hilbert;
+  ZoomFFT    Zoom[7];
+  double     SyncCoeff[4], SyncPower[4];
+  SNREstimator snr;
+  PulseFilter  pulse;
+  PixelSched   Sched;
+  gboolean     Tall;
+
+  // Initialize Hann windows of different lengths, as long as these are at 44100 Hz
+  gushort HannLens[7] = HANN_LENS;
+  for (j = 0; j < 7; j++)
+    HannLens[j] = scaleLen(d, HannLens[j]);
+  for (j = 0; j < 7; j++)
+    for (i = 0; i < HannLens[j]; i++)
+      Hann[j][i] = 0.5 * (1 - cos( (2 * M_PI * i) / (HannLens[j] - 1)) );
+
+
+  // Where and when to take out the first pixel
+  initSched(&Sched, Mode, Rate, Skip);
+
+  // The channels as received, each a plane of lines
+  Image = calloc(3 * Width * NumLines, sizeof(guchar));
+  if (Image == NULL) {
+    perror("GetVideo: Unable to allocate memory for image");
+    exit(EXIT_FAILURE);
   }
 
         /*case PD50:
@@ -155,259 +398,245 @@ gboolean GetVideo(guchar Mode, double Rate, int Skip, gboolean Redraw) {
           break;*/
 
   // Initialize pixbuffer
-  if (!Redraw) {
-    g_object_unref(pixbuf_rx);
-    pixbuf_rx = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, ModeSpec[Mode].ImgWidth, ModeSpec[Mode].NumLines);
-    gdk_pixbuf_fill(pixbuf_rx, 0);
-  }
-
-  int     rowstride = gdk_pixbuf_get_rowstride (pixbuf_rx);
-  guchar *pixels, *p;
-  pixels = gdk_pixbuf_get_pixels(pixbuf_rx);
+  g_object_unref(d->CurrentPic.pixbuf);
+  d->CurrentPic.pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, ModeSpec[Mode].ImgWidth, ModeSpec[Mode].NumLines);
+  gdk_pixbuf_fill(d->CurrentPic.pixbuf, 0);
 
-  g_object_unref(pixbuf_disp);
-  pixbuf_disp = gdk_pixbuf_scale_simple(pixbuf_rx, 500,
-      500.0/ModeSpec[Mode].ImgWidth * ModeSpec[Mode].NumLines * ModeSpec[Mode].LineHeight, GDK_INTERP_BILINEAR);
+  int     rowstride = gdk_pixbuf_get_rowstride (d->CurrentPic.pixbuf);
+  guchar *pixels;
+  pixels = gdk_pixbuf_get_pixels(d->CurrentPic.pixbuf);
 
-  gdk_threads_enter();
-  gtk_image_set_from_pixbuf(GTK_IMAGE(gui.image_rx), pixbuf_disp);
-  gdk_threads_leave();
+  showImage(d, -1);
 
-  Length        = ModeSpec[Mode].LineTime * ModeSpec[Mode].NumLines * 44100;
-  SyncTargetBin = GetBin(1200+CurrentPic.HedrShift, FFTLen);
-  Abort         = FALSE;
+  Length        = ModeSpec[Mode].LineTime * ModeSpec[Mode].NumLines * d->SampleRate;
+  d->Abort         = FALSE;
   SyncSampleNum = 0;
+  sdft.WinLen   = 0;
 
-  // Loop through signal
-  for (SampleNum = 0; SampleNum < Length; SampleNum++) {
-
-    if (!Redraw) {
+  if (d->Options.DemodEngine == DEMOD_HILBERT) initHilbert(&hilbert, d->SampleRate, 1900 + d->CurrentPic.HedrShift);
 
-      /*** Read ahead from sound card ***/
+  // Let the SNR filters settle on what came before the picture
+  initSNR(&snr, d->SampleRate, d->CurrentPic.HedrShift);
+  if (d->pcm.WindowPtr >= scaleLen(d, 1024))
+    for (i = d->pcm.WindowPtr - scaleLen(d, 1024); i < (guint)d->pcm.WindowPtr; i++) updateSNR(&snr, d->pcm.Buffer[i]);
 
-      if (pcm.WindowPtr == 0 || pcm.WindowPtr >= BUFLEN-1024) readPcm(2048);
-     
+  // Pulses are timed from the first sample of the picture, and fitted to
+  // lines as they come
+  initPulse(&pulse, d, ModeSpec[Mode].SyncTime, 1200 + d->CurrentPic.HedrShift);
+  initSlantTracker(d, Mode, Rate, d->CurrentPic.HedrShift);
 
-      /*** Store the sync band for later adjustments ***/
+  // Goertzel coefficients for the sync tone and the video band
+  SyncCoeff[0] = 2 * cos(2 * M_PI * (1200 + d->CurrentPic.HedrShift) / d->SampleRate);
+  SyncCoeff[1] = 2 * cos(2 * M_PI * (1500 + d->CurrentPic.HedrShift) / d->SampleRate);
+  SyncCoeff[2] = 2 * cos(2 * M_PI * (1900 + d->CurrentPic.HedrShift) / d->SampleRate);
+  SyncCoeff[3] = 2 * cos(2 * M_PI * (2300 + d->CurrentPic.HedrShift) / d->SampleRate);
 
-      if (SampleNum == NextSyncTime) {
- 
-        Praw = Psync = 0;
+  // Video band bins, moved along with the tracked shift
+  LoBin  = GetBin(d, 1500 + round(Shift), FFTLen) - 1;
+  HiBin  = GetBin(d, 2300 + round(Shift), FFTLen) + 1;
+  MidBin = GetBin(d, 1900 + round(Shift), FFTLen);
 
-        memset(fft.in, 0, sizeof(double)*FFTLen);
-       
-        // Hann window
-        for (i = 0; i < 64; i++) fft.in[i] = pcm.Buffer[pcm.WindowPtr+i-32] / 32768.0 * Hann[1][i];
+  // Zoom in on the bands of interest where that beats a zero-padded FFT
+  for (j = 0; j < 7; j++)
+    initZoomFFT(&Zoom[j], Hann[j], HannLens[j], FFTLen, LoBin, HiBin);
 
-        fftw_execute(fft.Plan1024);
+  // Loop through signal
+  for (SampleNum = 0; SampleNum < Length; SampleNum++) {
 
-        for (i=GetBin(1500+CurrentPic.HedrShift,FFTLen); i<=GetBin(2300+CurrentPic.HedrShift, FFTLen); i++)
-          Praw += power(fft.out[i]);
+    /*** Read ahead from sound card ***/
 
-        for (i=SyncTargetBin-1; i<=SyncTargetBin+1; i++)
-          Psync += power(fft.out[i]) * (1- .5*abs(SyncTargetBin-i));
+    if (d->pcm.WindowPtr == 0 || d->pcm.WindowPtr >= BUFLEN-1024) readPcm(d, 2048);
+   
 
-        Praw  /= (GetBin(2300+CurrentPic.HedrShift, FFTLen) - GetBin(1500+CurrentPic.HedrShift, FFTLen));
-        Psync /= 2.0;
+    /*** Store the sync band for later adjustments ***/
 
-        // If there is more than twice the amount of power per Hz in the
-        // sync band than in the video band, we have a sync signal here
-        HasSync[SyncSampleNum] = (Psync > 2*Praw);
+    feedPulse(&pulse, d->pcm.Buffer[d->pcm.WindowPtr]);
 
-        NextSyncTime += 13;
-        SyncSampleNum ++;
+    if (SampleNum == NextSyncTime) {
+ 
+      // Windowed power at the sync tone and across the video band
+      goertzel(d->pcm.Buffer + d->pcm.WindowPtr - HannLens[1]/2, Hann[1], HannLens[1], 4, SyncCoeff, SyncPower);
 
-      }
+      // The 1.5 ms window smears each tone over ~1 kHz, so three
+      // points (Simpson's rule) give the mean power over 1500..2300 Hz
+      Psync = SyncPower[0];
+      Praw  = (SyncPower[1] + 4 * SyncPower[2] + SyncPower[3]) / 6;
 
+      // If there is more than twice the amount of power per Hz in the
+      // sync band than in the video band, we have a sync signal here
+      storeSync(d, SyncSampleNum, Psync, Praw);
 
+      SyncSampleNum ++;
+      NextSyncTime = round(SyncSampleNum * d->SyncHop);
 
-      /*** Estimate SNR ***/
+      // Follow any drift of the whole signal on the sync pulses
+      trackSlant(d);
+      Shift = getTrackedShift(d);
 
-      if (SampleNum == NextSNRtime) {
-        
-        memset(fft.in, 0, sizeof(double)*FFTLen);
+    }
 
-        // Apply Hann window
-        for (i = 0; i < FFTLen; i++) fft.in[i] = pcm.Buffer[pcm.WindowPtr + i - FFTLen/2] / 32768.0 * Hann[6][i];
 
-        fftw_execute(fft.Plan1024);
 
-        // Calculate video-plus-noise power (1500-2300 Hz)
+    /*** Estimate SNR ***/
 
-        Pvideo_plus_noise = 0;
-        for (n = GetBin(1500+CurrentPic.HedrShift, FFTLen); n <= GetBin(2300+CurrentPic.HedrShift, FFTLen); n++)
-          Pvideo_plus_noise += power(fft.out[n]);
+    updateSNR(&snr, d->pcm.Buffer[d->pcm.WindowPtr]);
 
-        // Calculate noise-only power (400-800 Hz + 2700-3400 Hz)
+    if (SampleNum == NextSNRtime) {
+      SNR          = getSNR(&snr);
+      NextSNRtime += SNRHop;
+    }
 
-        Pnoise_only = 0;
-        for (n = GetBin(400+CurrentPic.HedrShift,  FFTLen); n <= GetBin(800+CurrentPic.HedrShift, FFTLen);  n++)
-          Pnoise_only += power(fft.out[n]);
 
-        for (n = GetBin(2700+CurrentPic.HedrShift, FFTLen); n <= GetBin(3400+CurrentPic.HedrShift, FFTLen); n++)
-          Pnoise_only += power(fft.out[n]);
 
-        // Bandwidths
-        VideoPlusNoiseBins = GetBin(2300, FFTLen) - GetBin(1500, FFTLen) + 1;
+    /*** FM demodulation ***/
 
-        NoiseOnlyBins      = GetBin(800,  FFTLen) - GetBin(400,  FFTLen) + 1 +
-                             GetBin(3400, FFTLen) - GetBin(2700, FFTLen) + 1;
+    // The sliding DFT has to see every sample go by
+    if (d->Options.DemodEngine == DEMOD_SDFT && sdft.WinLen > 0)
+      slideSDFT(&sdft, d->pcm.Buffer + d->pcm.WindowPtr);
 
-        ReceiverBins       = GetBin(3400, FFTLen) - GetBin(400,  FFTLen);
+    if (SampleNum % FFTHop == 0) { // Take FFT every LumHop samples, LUMHOP scaled to SampleRate
 
-        // Eq 15
-        Pnoise  = Pnoise_only * (1.0 * ReceiverBins / NoiseOnlyBins);
-        Psignal = Pvideo_plus_noise - Pnoise_only * (1.0 * VideoPlusNoiseBins / NoiseOnlyBins);
+      // Search where the reference is now
+      LoBin  = GetBin(d, 1500 + round(Shift), FFTLen) - 1;
+      HiBin  = GetBin(d, 2300 + round(Shift), FFTLen) + 1;
+      MidBin = GetBin(d, 1900 + round(Shift), FFTLen);
 
-        // Lower bound to -20 dB
-        SNR = ((Psignal / Pnoise < .01) ? -20 : 10 * log10(Psignal / Pnoise));
+      // Adapt window size to SNR; only move once the SNR is clearly
+      // past a threshold so that the window doesn't flap
 
-        NextSNRtime += 256;
+      if (!d->Options.Adaptive) {
+        SNRIdx = 0;
+      } else {
+        if (SNRIdx < WinIdxForSNR(SNR + .5)) SNRIdx = WinIdxForSNR(SNR + .5);
+        if (SNRIdx > WinIdxForSNR(SNR - .5)) SNRIdx = WinIdxForSNR(SNR - .5);
       }
+      WinIdx = SNRIdx;
+
+      // Minimum winlength can be doubled for Scottie DX
+      if (Mode == SDX && WinIdx < 6) WinIdx++;
+
+      WinLength = HannLens[WinIdx];
 
+      // Move the zoom along with the band
+      if (d->Options.DemodEngine != DEMOD_SDFT && Zoom[WinIdx].WinLen > 0 &&
+          (Zoom[WinIdx].LoBin != LoBin || Zoom[WinIdx].NumBins != HiBin - LoBin + 1)) {
+        freeZoomFFT(&Zoom[WinIdx]);
+        initZoomFFT(&Zoom[WinIdx], Hann[WinIdx], WinLength, FFTLen, LoBin, HiBin);
+      }
 
+      if (d->Options.DemodEngine == DEMOD_SDFT) {
 
-      /*** FM demodulation ***/
+        // Start over on window or band change, and now and then to shed rounding errors
+        if (sdft.WinLen != (int)WinLength || sdft.LoBin != LoBin || sdft.HiBin != HiBin || sdft.Age > 65536)
+          initSDFT(&sdft, d->pcm.Buffer + d->pcm.WindowPtr, WinLength, FFTLen, LoBin, HiBin);
 
-      if (SampleNum % 6 == 0) { // Take FFT every 6 samples
+        powerSDFT(&sdft, Power);
 
-        PrevFreq = Freq;
+        // Find the bin with most power
+        MaxBin = peakBin(Power, LoBin, HiBin);
 
-        // Adapt window size to SNR
+      } else if ((d->Options.DemodEngine == DEMOD_FFT || SampleNum % VUHop == 0) && Zoom[WinIdx].WinLen > 0) {
 
-        if      (!Adaptive)  WinIdx = 0;
-        
-        else if (SNR >=  20) WinIdx = 0;
-        else if (SNR >=  10) WinIdx = 1;
-        else if (SNR >=   9) WinIdx = 2;
-        else if (SNR >=   3) WinIdx = 3;
-        else if (SNR >=  -5) WinIdx = 4;
-        else if (SNR >= -10) WinIdx = 5;
-        else                 WinIdx = 6;
+        // (the quadrature demodulator only needs this for the VU meter)
+        zoomPower(&Zoom[WinIdx], d->pcm.Buffer + d->pcm.WindowPtr, Power);
 
-        // Minimum winlength can be doubled for Scottie DX
-        if (Mode == SDX && WinIdx < 6) WinIdx++;
+        MaxBin = peakBin(Power, LoBin, HiBin);
 
-        memset(fft.in, 0, sizeof(double)*FFTLen);
-        memset(Power,  0, sizeof(double)*1024);
+      } else if (d->Options.DemodEngine == DEMOD_FFT || SampleNum % VUHop == 0) {
 
         // Apply window function
-        
-        WinLength = HannLens[WinIdx];
-        for (i = 0; i < WinLength; i++) fft.in[i] = pcm.Buffer[pcm.WindowPtr + i - WinLength/2] / 32768.0 * Hann[WinIdx][i];
+        windowFFT(&d->fft, d->pcm.Buffer + d->pcm.WindowPtr - WinLength/2, Hann[WinIdx], WinLength);
 
-        fftw_execute(fft.Plan1024);
+        FFTW(execute_dft_r2c)(getPlan(FFTLen), d->fft.in, d->fft.out);
 
-        MaxBin = 0;
-          
-        // Find the bin with most power
-        for (n = GetBin(1500 + CurrentPic.HedrShift, FFTLen) - 1; n <= GetBin(2300 + CurrentPic.HedrShift, FFTLen) + 1; n++) {
+        MaxBin = powerPeak(d->fft.out, Power, LoBin, HiBin);
 
-          Power[n] = power(fft.out[n]);
-          if (MaxBin == 0 || Power[n] > Power[MaxBin]) MaxBin = n;
+      }
 
-        }
+      if (d->Options.DemodEngine != DEMOD_HILBERT) {
 
         // Find the peak frequency by Gaussian interpolation
-        if (MaxBin > GetBin(1500 + CurrentPic.HedrShift, FFTLen) - 1 && MaxBin < GetBin(2300 + CurrentPic.HedrShift, FFTLen) + 1) {
-          Freq = MaxBin +            (log( Power[MaxBin + 1] / Power[MaxBin - 1] )) /
-                           (2 * log( pow(Power[MaxBin], 2) / (Power[MaxBin + 1] * Power[MaxBin - 1])));
+        if (MaxBin > LoBin && MaxBin < HiBin) {
           // In Hertz
-          Freq = Freq / FFTLen * 44100;
+          Freq = peakInterp(Power, MaxBin) / FFTLen * d->SampleRate;
         } else {
           // Clip if out of bounds
-          Freq = ( (MaxBin > GetBin(1900 + CurrentPic.HedrShift, FFTLen)) ? 2300 : 1500 ) + CurrentPic.HedrShift;
+          Freq = ( (MaxBin > MidBin) ? 2300 : 1500 ) + Shift;
         }
 
-      } /* endif (SampleNum == PixelGrid[PixelIdx].Time) */
-
-      // Linear interpolation of (chronologically) intermediate frequencies, for redrawing
-      //InterpFreq = PrevFreq + (Freq-PrevFreq) * ...  // TODO!
+      }
 
-      // Calculate luminency & store for later use
-      StoredLum[SampleNum] = clip((Freq - (1500 + CurrentPic.HedrShift)) / 3.1372549);
+    } /* endif (SampleNum % FFTHop == 0) */
 
-    } /* endif (!Redraw) */
+    // hilbertFreq() has to run on every sample to keep its filter and
+    // running sum going, but only the hop sample's frequency is stored
+    if (d->Options.DemodEngine == DEMOD_HILBERT)
+      Freq = hilbertFreq(&hilbert, d->pcm.Buffer + d->pcm.WindowPtr, WinLength / 2);
 
+    // Calculate luminency & store one per hop for later use
+    if (SampleNum % FFTHop == 0) {
+      Lum = (Freq - (1500 + Shift)) / 3.1372549;
+      d->StoredLum[SampleNum / FFTHop] = CLAMP(Lum, 0, 255) * LUM_ONE + .5;
+      Stored = SampleNum / FFTHop + 1;
+    }
 
+    // Pixels fall between stored values; take them out once the value after
+    // them is in, or at the end
+    while (!Sched.Done && (Sched.Time < (Stored - 1) * FFTHop ||
+          (SampleNum == Length - 1 && Sched.Time <= SampleNum))) {
 
-    if (SampleNum == PixelGrid[PixelIdx].Time) {
+      x       = Sched.X;
+      y       = Sched.Y;
+      Channel = Sched.Channel;
+      Tall    = Sched.Tall;
 
-      x = PixelGrid[PixelIdx].X;
-      y = PixelGrid[PixelIdx].Y;
-      Channel = PixelGrid[PixelIdx].Channel;
-      
       // Store pixel
-      Image[x][y][Channel] = StoredLum[SampleNum];
+      Image[(Channel * NumLines + y) * Width + x] = clip(lumAt(d, Sched.Time, Stored));
 
       // Some modes have R-Y & B-Y channels that are twice the height of the Y channel
-      if (Channel > 0 && (Mode == R36 || Mode == R24))
-        Image[x][y+1][Channel] = StoredLum[SampleNum];
+      if (Tall && y+1 < NumLines)
+        Image[(Channel * NumLines + y+1) * Width + x] = Image[(Channel * NumLines + y) * Width + x];
 
-      // Calculate and draw pixels to pixbuf on line change
-      if (x == ModeSpec[Mode].ImgWidth-1 || PixelGrid[PixelIdx].Last) {
-        for (tx = 0; tx < ModeSpec[Mode].ImgWidth; tx++) {
-          p = pixels + y * rowstride + tx * 3;
-
-          switch(ModeSpec[Mode].ColorEnc) {
-
-            case RGB:
-              p[0] = Image[tx][y][0];
-              p[1] = Image[tx][y][1];
-              p[2] = Image[tx][y][2];
-              break;
-
-            case GBR:
-              p[0] = Image[tx][y][2];
-              p[1] = Image[tx][y][0];
-              p[2] = Image[tx][y][1];
-              break;
-
-            case YUV:
-              p[0] = clip((100 * Image[tx][y][0] + 140 * Image[tx][y][1] - 17850) / 100.0);
-              p[1] = clip((100 * Image[tx][y][0] -  71 * Image[tx][y][1] - 33 *
-                  Image[tx][y][2] + 13260) / 100.0);
-              p[2] = clip((100 * Image[tx][y][0] + 178 * Image[tx][y][2] - 22695) / 100.0);
-              break;
-
-            case BW:
-              p[0] = p[1] = p[2] = Image[tx][y][0];
-              break;
-
-          }
-        }
+      Sched.Done = !Sched.Next(&Sched);
 
-        if (!Redraw || y % 5 == 0 || PixelGrid[PixelIdx].Last) {
-          // Scale and update image
-          g_object_unref(pixbuf_disp);
-          pixbuf_disp = gdk_pixbuf_scale_simple(pixbuf_rx, 500,
-              500.0/ModeSpec[Mode].ImgWidth * ModeSpec[Mode].NumLines * ModeSpec[Mode].LineHeight, GDK_INTERP_BILINEAR);
+      // Calculate and draw pixels to pixbuf on line change
+      if (x == Width-1) {
+        paintLine(pixels + y * rowstride, ModeSpec[Mode].ColorEnc, Image + y * Width,
+            Image + (NumLines + y) * Width, Image + (2 * NumLines + y) * Width, Width);
 
-          gdk_threads_enter();
-          gtk_image_set_from_pixbuf(GTK_IMAGE(gui.image_rx), pixbuf_disp);
-          gdk_threads_leave();
-        }
+        // Scale and update image
+        showImage(d, y);
       }
 
-      PixelIdx ++;
-
-
-    } /* endif (SampleNum == PixelGrid[PixelIdx].Time) */
+    } /* endwhile (pixels up to SampleNum) */
     
-    if (!Redraw && SampleNum % 8820 == 0) {
-      setVU(Power, FFTLen, WinIdx, TRUE);
+    if (SampleNum % VUHop == 0) {
+      setVU(d, Power, FFTLen, WinIdx, TRUE);
     }
 
-    if (Abort) {
-      free(PixelGrid);
+    if (d->Abort) {
+      for (j = 0; j < 7; j++) freeZoomFFT(&Zoom[j]);
+      freePulse(&pulse);
+      free(Image);
       return FALSE;
     }
 
-    pcm.WindowPtr ++;
+    d->pcm.WindowPtr ++;
 
   }
 
-  free(PixelGrid);
+  for (j = 0; j < 7; j++) freeZoomFFT(&Zoom[j]);
+  free(Image);
+  flushPulse(&pulse);
+  freePulse(&pulse);
+  trackSlant(d);
+
+  // The FSK ID follows on the same carrier
+  Shift = round(getTrackedShift(d));
+  if (Shift != d->CurrentPic.HedrShift) {
+    printf("  HedrShift drifted %+d -> %+d Hz\n", d->CurrentPic.HedrShift, (int)Shift);
+    d->CurrentPic.HedrShift = Shift;
+  }
   return TRUE;
 
 }
@@ -1,7 +1,7 @@
+#include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
-#include <gtk/gtk.h>
-#include <alsa/asoundlib.h>
+#include <gdk-pixbuf/gdk-pixbuf.h>
 
 #include <fftw3.h>
 
@@ -11,63 +11,55 @@
  *
  * Detect VIS & frequency shift
  *
- * Each bit lasts 30 ms (1323 samples)
+ * Each bit lasts 30 ms, three 10 ms steps
  *
  */
 
-guchar GetVIS () {
+guchar GetVIS (Decoder *d) {
 
   int        selmode, ptr=0;
   int        VIS = 0, Parity = 0, HedrPtr = 0;
-  guint      FFTLen = 2048, i=0, j=0, k=0, MaxBin = 0;
-  double     Power[2048] = {0}, HedrBuf[100] = {0}, tone[100] = {0}, Hann[882] = {0};
+  guint      FFTLen = scaleFFT(d, 2048), i=0, j=0, k=0, MaxBin = 0;
+  int        Step = scaleLen(d, 441), WinLen = 2 * Step;
+  double     HedrBuf[100] = {0}, tone[100] = {0};
+  dsp_t      Power[FFT_MAXLEN] = {0}, Hann[FFT_MAXLEN] = {0};
   gboolean   gotvis = FALSE;
   guchar     Bit[8] = {0}, ParityBit = 0;
 
-  for (i = 0; i < FFTLen; i++) fft.in[i]    = 0;
-
   // Create 20ms Hann window
-  for (i = 0; i < 882; i++) Hann[i] = 0.5 * (1 - cos( (2 * M_PI * (double)i) / 881 ) );
+  for (i = 0; i < (guint)WinLen; i++) Hann[i] = 0.5 * (1 - cos( (2 * M_PI * (double)i) / (WinLen - 1) ) );
 
-  ManualActivated = FALSE;
+  d->ManualActivated = FALSE;
   
   printf("Waiting for header\n");
 
-  gdk_threads_enter();
-  gtk_statusbar_push( GTK_STATUSBAR(gui.statusbar), 0, "Listening" );
-  gdk_threads_leave();
+  showStatus(d, "Listening");
 
   while ( TRUE ) {
 
-    if (Abort || ManualResync) return(0);
+    if (d->Abort || d->ManualResync) return(0);
 
     // Read 10 ms from sound card
-    readPcm(441);
+    readPcm(d, Step);
 
     // Apply Hann window
-    for (i = 0; i < 882; i++) fft.in[i] = pcm.Buffer[pcm.WindowPtr + i - 441] / 32768.0 * Hann[i];
+    windowFFT(&d->fft, d->pcm.Buffer + d->pcm.WindowPtr - Step, Hann, WinLen);
 
     // FFT of last 20 ms
-    fftw_execute(fft.Plan2048);
-
-    // Find the bin with most power
-    MaxBin = 0;
-    for (i = 0; i <= GetBin(6000, FFTLen); i++) {
-      Power[i] = power(fft.out[i]);
-      if ( (i >= GetBin(500,FFTLen) && i < GetBin(3300,FFTLen)) &&
-           (MaxBin == 0 || Power[i] > Power[MaxBin]))
-        MaxBin = i;
-    }
+    FFTW(execute_dft_r2c)(getPlan(FFTLen), d->fft.in, d->fft.out);
+
+    // Power up to 6 kHz for the VU meter, then find the bin with most power
+    powerSpectrum(d->fft.out, Power, 0, MIN(GetBin(d, 6000, FFTLen), FFTLen/2));
+    MaxBin = peakBin(Power, GetBin(d, 500, FFTLen), GetBin(d, 3300, FFTLen) - 1);
 
     // Find the peak frequency by Gaussian interpolation
-    if (MaxBin > GetBin(500, FFTLen) && MaxBin < GetBin(3300, FFTLen) &&
+    if (MaxBin > GetBin(d, 500, FFTLen) && MaxBin < GetBin(d, 3300, FFTLen) &&
         Power[MaxBin] > 0 && Power[MaxBin+1] > 0 && Power[MaxBin-1] > 0)
-         HedrBuf[HedrPtr] = MaxBin +            (log( Power[MaxBin + 1] / Power[MaxBin - 1] )) /
-                             (2 * log( pow(Power[MaxBin], 2) / (Power[MaxBin + 1] * Power[MaxBin - 1])));
+         HedrBuf[HedrPtr] = peakInterp(Power, MaxBin);
     else HedrBuf[HedrPtr] = HedrBuf[(HedrPtr-1) % 45];
 
     // In Hertz
-    HedrBuf[HedrPtr] = HedrBuf[HedrPtr] / FFTLen * 44100;
+    HedrBuf[HedrPtr] = HedrBuf[HedrPtr] / FFTLen * d->SampleRate;
 
     // Header buffer holds 45 * 10 msec = 450 msec
     HedrPtr = (HedrPtr + 1) % 45;
@@ -77,10 +69,10 @@ guchar GetVIS () {
 
     // Is there a pattern that looks like (the end of) a calibration header + VIS?
     // Tolerance ±25 Hz
-    CurrentPic.HedrShift = 0;
+    d->CurrentPic.HedrShift = 0;
     gotvis    = FALSE;
     for (i = 0; i < 3; i++) {
-      if (CurrentPic.HedrShift != 0) break;
+      if (d->CurrentPic.HedrShift != 0) break;
       for (j = 0; j < 3; j++) {
         if ( (tone[1*3+i]  > tone[0+j] - 25  && tone[1*3+i]  < tone[0+j] + 25)  && // 1900 Hz leader
              (tone[2*3+i]  > tone[0+j] - 25  && tone[2*3+i]  < tone[0+j] + 25)  && // 1900 Hz leader
@@ -103,13 +95,13 @@ guchar GetVIS () {
             }
           }
           if (gotvis) {
-            CurrentPic.HedrShift = tone[0+j] - 1900;
+            d->CurrentPic.HedrShift = tone[0+j] - 1900;
 
             VIS = Bit[0] + (Bit[1] << 1) + (Bit[2] << 2) + (Bit[3] << 3) + (Bit[4] << 4) +
                  (Bit[5] << 5) + (Bit[6] << 6);
             ParityBit = Bit[7];
 
-            printf("  VIS %d (%02Xh) @ %+d Hz\n", VIS, VIS, CurrentPic.HedrShift);
+            printf("  VIS %d (%02Xh) @ %+d Hz\n", VIS, VIS, d->CurrentPic.HedrShift);
 
             Parity = Bit[0] ^ Bit[1] ^ Bit[2] ^ Bit[3] ^ Bit[4] ^ Bit[5] ^ Bit[6];
 
@@ -122,10 +114,6 @@ guchar GetVIS () {
               printf("  Unknown VIS\n");
               gotvis = FALSE;
             } else {
-              gdk_threads_enter();
-              gtk_combo_box_set_active (GTK_COMBO_BOX(gui.combo_mode), VISmap[VIS]-1);
-              gtk_spin_button_set_value (GTK_SPIN_BUTTON(gui.spin_shift), CurrentPic.HedrShift);
-              gdk_threads_leave();
               break;
             }
           }
@@ -133,19 +121,15 @@ guchar GetVIS () {
       }
     }
 
+    // The front end may not want it
     if (gotvis)
-     if (gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(gui.tog_rx))) break;
+     if (d->Callbacks.VIS == NULL || d->Callbacks.VIS(d, VISmap[VIS], d->CurrentPic.HedrShift)) break;
 
     // Manual start
-    if (ManualActivated) {
-
-      gdk_threads_enter();
-      gtk_widget_set_sensitive( gui.frame_manual, FALSE );
-      gtk_widget_set_sensitive( gui.combo_card,   FALSE );
-      gdk_threads_leave();
+    if (d->ManualActivated) {
 
-      selmode   = gtk_combo_box_get_active (GTK_COMBO_BOX(gui.combo_mode)) + 1;
-      CurrentPic.HedrShift = gtk_spin_button_get_value_as_int (GTK_SPIN_BUTTON(gui.spin_shift));
+      selmode   = d->ManualMode;
+      d->CurrentPic.HedrShift = d->ManualShift;
       VIS = 0;
       for (i=0; i<0x80; i++) {
         if (VISmap[i] == selmode) {
@@ -158,16 +142,16 @@ guchar GetVIS () {
     }
 
     if (++ptr == 10) {
-      setVU(Power, 2048, 6, FALSE);
+      setVU(d, Power, FFTLen, 6, FALSE);
       ptr = 0;
     }
 
-    pcm.WindowPtr += 441;
+    d->pcm.WindowPtr += Step;
   }
 
   // Skip the rest of the stop bit
-  readPcm(20e-3 * 44100);
-  pcm.WindowPtr += 20e-3 * 44100;
+  readPcm(d, 2 * Step);
+  d->pcm.WindowPtr += 2 * Step;
 
   if (VISmap[VIS] != UNKNOWN) return VISmap[VIS];
   else                        printf("  No VIS found\n");